@@ -0,0 +1,158 @@
+/**
+ * Counts the C++ allocations made to serve a request, the requests are sent
+ * one connection at a time by the main thread while the server runs.
+ *
+ * Usage: allocations [port, default 8090] [requests, default 2000]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <new>
+#include <mongoose/Server.h>
+#include <mongoose/WebController.h>
+
+using namespace std;
+using namespace Mongoose;
+
+static volatile long allocations = 0;
+static volatile long allocated = 0;
+
+void *operator new(size_t size)
+{
+    __sync_fetch_and_add(&allocations, 1);
+    __sync_fetch_and_add(&allocated, (long) size);
+
+    void *data = malloc(size ? size : 1);
+    if (data == NULL) {
+        throw std::bad_alloc();
+    }
+
+    return data;
+}
+
+void operator delete(void *data) throw()
+{
+    free(data);
+}
+
+class BenchController : public WebController
+{
+    public:
+        void hello(Request &request, StreamResponse &response)
+        {
+            response << "Hello " << htmlEntities(request.get("name", "nobody")) << endl;
+        }
+
+        void plain(Request &request, StreamResponse &response)
+        {
+            response << "ok";
+        }
+
+        void setup()
+        {
+            addRoute("GET", "/hello", BenchController, hello);
+            addRoute("GET", "/plain", BenchController, plain);
+        }
+};
+
+/**
+ * Sends a request on a new connection and reads the response into buffer,
+ * without allocating
+ *
+ * @return int the size of the response, -1 on error
+ */
+static int query(int port, const char *path, const char *cookie, char *buffer, int size)
+{
+    struct sockaddr_in address;
+    char head[512];
+    int length = 0;
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *) &address, sizeof(address)) != 0) {
+        if (sock >= 0) {
+            close(sock);
+        }
+        return -1;
+    }
+
+    // A response without length is over once nothing comes for a while
+    struct timeval timeout;
+    timeout.tv_sec = 1;
+    timeout.tv_usec = 0;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char *) &timeout, sizeof(timeout));
+
+    int headSize = snprintf(head, sizeof(head), "GET %s HTTP/1.1\r\nHost: localhost\r\n"
+            "User-Agent: bench\r\nAccept: */*\r\n%s\r\n", path, cookie);
+    send(sock, head, headSize, 0);
+
+    // Read until the body is complete, or the server closes
+    while (length < size - 1) {
+        int received = recv(sock, buffer + length, size - 1 - length, 0);
+        if (received <= 0) {
+            break;
+        }
+        length += received;
+        buffer[length] = '\0';
+
+        const char *body = strstr(buffer, "\r\n\r\n");
+        const char *contentLength = strstr(buffer, "Content-Length: ");
+        if (body != NULL && contentLength != NULL &&
+                buffer + length - (body + 4) >= atoi(contentLength + 16)) {
+            break;
+        }
+    }
+    close(sock);
+
+    return length;
+}
+
+int main(int argc, char *argv[])
+{
+    int port = argc > 1 ? atoi(argv[1]) : 8090;
+    int requests = argc > 2 ? atoi(argv[2]) : 2000;
+    const char *paths[] = {"/hello?name=bob", "/plain"};
+    char portName[16], buffer[4096], cookie[256] = "";
+
+    snprintf(portName, sizeof(portName), "%d", port);
+    Server server(portName);
+    server.registerController(new BenchController);
+    server.start();
+
+    // The session is created once, the requests below reuse it
+    if (query(port, "/hello", "", buffer, sizeof(buffer)) < 0) {
+        fprintf(stderr, "Can't reach the server on port %d\n", port);
+        return 1;
+    }
+    const char *sessid = strstr(buffer, "sessid=");
+    if (sessid != NULL) {
+        snprintf(cookie, sizeof(cookie), "Cookie: %.*s\r\n", (int) strcspn(sessid, ";\r"), sessid);
+    }
+
+    for (unsigned int i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+        query(port, paths[i], cookie, buffer, sizeof(buffer));
+
+        long allocationsBefore = allocations;
+        long allocatedBefore = allocated;
+        for (int n = 0; n < requests; n++) {
+            query(port, paths[i], cookie, buffer, sizeof(buffer));
+        }
+
+        printf("%-16s %6.2f allocations/request %8.0f bytes/request\n", paths[i],
+                (double) (allocations - allocationsBefore) / requests,
+                (double) (allocated - allocatedBefore) / requests);
+    }
+
+    server.stop();
+
+    return 0;
+}
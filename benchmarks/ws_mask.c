@@ -0,0 +1,80 @@
+/*
+ * Checks the websocket masking kernels against the byte loop, for every
+ * length up to 300 at every misalignment, then times both on payloads of
+ * a few sizes. The kernels are static, mongoose.c is compiled in.
+ *
+ * Usage: ws_mask [total bytes per size, default 256 MB]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "mongoose.c"
+
+#define CHECK_LENGTH 300
+#define CHECK_OFFSETS 8
+
+static void mask_bytes(unsigned char *data, size_t len,
+                       const unsigned char *mask) {
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    data[i] ^= mask[i % 4];
+  }
+}
+
+static int check(void) {
+  unsigned char expected[CHECK_LENGTH + CHECK_OFFSETS];
+  unsigned char actual[CHECK_LENGTH + CHECK_OFFSETS];
+  const unsigned char mask[4] = {0x12, 0x9a, 0xe4, 0x37};
+  size_t len, offset, i;
+  int errors = 0;
+
+  for (len = 0; len <= CHECK_LENGTH; len++) {
+    for (offset = 0; offset < CHECK_OFFSETS; offset++) {
+      for (i = 0; i < sizeof(actual); i++) {
+        expected[i] = actual[i] = (unsigned char) (i * 31 + len);
+      }
+      mask_bytes(expected + offset, len, mask);
+      mg_ws_mask(actual + offset, len, mask);
+      if (memcmp(expected, actual, sizeof(actual)) != 0) {
+        printf("mismatch: length %d, offset %d\n", (int) len, (int) offset);
+        errors++;
+      }
+    }
+  }
+
+  return errors;
+}
+
+static double measure(void (*fn)(unsigned char *, size_t,
+                                 const unsigned char *),
+                      unsigned char *data, size_t len, size_t total) {
+  const unsigned char mask[4] = {0x12, 0x9a, 0xe4, 0x37};
+  size_t rounds = total / len, i;
+  double start = cs_time();
+
+  for (i = 0; i < rounds; i++) {
+    fn(data, len, mask);
+  }
+
+  return (double) rounds * len / (cs_time() - start) / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+  static const size_t sizes[] = {16, 125, 1024, 65536, 1048576};
+  size_t total = argc > 1 ? (size_t) atol(argv[1]) : 256 * 1048576;
+  unsigned char *data = (unsigned char *) calloc(1, 1048576 + 1);
+  size_t i;
+  int errors = check();
+
+  printf("check: %d mismatches\n", errors);
+  printf("%10s %12s %12s\n", "bytes", "loop GB/s", "mask GB/s");
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    /* Off by one byte, like a payload after a frame header */
+    double loop = measure(mask_bytes, data + 1, sizes[i], total);
+    double kernel = measure(mg_ws_mask, data + 1, sizes[i], total);
+    printf("%10d %12.2f %12.2f\n", (int) sizes[i], loop, kernel);
+  }
+  free(data);
+
+  return errors == 0 ? 0 : 1;
+}
@@ -115,6 +115,9 @@ MG_INTERNAL int mg_http_common_url_parse(const char *url, const char *schema,
                                          char **user, char **pass, char **addr,
                                          int *port_i, const char **path);
 
+#if MG_ENABLE_FILESYSTEM && MG_ENABLE_DIRECTORY_LISTING
+MG_INTERNAL void mg_http_free_dir_listings(struct mg_mgr *mgr);
+#endif
 #if MG_ENABLE_FILESYSTEM
 MG_INTERNAL int mg_uri_to_local_path(struct http_message *hm,
                                      const struct mg_serve_http_opts *opts,
@@ -2209,6 +2212,10 @@ void mg_mgr_free(struct mg_mgr *m) {
     mg_close_conn(conn);
   }
 
+#if MG_ENABLE_HTTP && MG_ENABLE_FILESYSTEM && MG_ENABLE_DIRECTORY_LISTING
+  mg_http_free_dir_listings(m);
+#endif
+
   {
     int i;
     for (i = 0; i < m->num_ifaces; i++) {
@@ -3701,7 +3708,6 @@ time_t mg_socket_if_poll(struct mg_iface *iface, int timeout_ms) {
   return (time_t) now;
 }
 
-#if MG_ENABLE_BROADCAST
 int mg_socketpair(sock_t sp[2], int sock_type) {
   union socket_address sa;
   sock_t sock;
@@ -3743,7 +3749,6 @@ int mg_socketpair(sock_t sp[2], int sock_type) {
 
   return ret;
 }
-#endif /* MG_ENABLE_BROADCAST */
 
 static void mg_sock_get_addr(sock_t sock, int remote,
                              union socket_address *sa) {
@@ -4995,6 +5000,18 @@ struct mg_http_proto_data_chuncked {
   int64_t body_len; /* How many bytes of chunked body was reassembled. */
 };
 
+#if MG_ENABLE_HTTP_WEBSOCKET
+/*
+ * A fragmented websocket message being received: its frames stay in place at
+ * the start of recv_mbuf, unmasked, until the last one comes.
+ */
+struct mg_http_proto_data_ws_reassembly {
+  size_t len;          /* Bytes of recv_mbuf holding the frames received */
+  size_t size;         /* Payload of the data frames among them */
+  unsigned char flags; /* First frame header byte, 0 if none is pending */
+};
+#endif
+
 struct mg_http_endpoint {
   struct mg_http_endpoint *next;
   const char *name;
@@ -5027,10 +5044,36 @@ struct mg_reverse_proxy_data {
   struct mg_connection *linked_conn;
 };
 
+#if MG_ENABLE_FILESYSTEM && MG_ENABLE_DIRECTORY_LISTING
+/*
+ * Rendered table rows of a directory. Listings are cached per manager and
+ * shared with every connection that is still streaming them, hence refcnt.
+ */
+struct mg_dir_listing {
+  struct mg_dir_listing *next;
+  char *dir;          /* Local path of the listed directory */
+  char *hidden;       /* hidden_file_pattern the rows were filtered with */
+  char *auth_file;    /* per_directory_auth_file the rows were filtered with */
+  time_t mtime;       /* Directory mtime the rows were rendered for */
+  time_t rendered_at; /* When the rows were rendered */
+  struct mbuf rows;   /* Rendered <tr> elements */
+  DIR *dirp;          /* Open until all the rows are rendered */
+  int refcnt;
+};
+
+struct mg_http_proto_data_dir_listing {
+  struct mg_dir_listing *listing; /* Listing being streamed, or NULL */
+  size_t sent;                    /* How many bytes of rows were sent */
+};
+#endif
+
 struct mg_http_proto_data {
 #if MG_ENABLE_FILESYSTEM
   struct mg_http_proto_data_file file;
 #endif
+#if MG_ENABLE_FILESYSTEM && MG_ENABLE_DIRECTORY_LISTING
+  struct mg_http_proto_data_dir_listing dir_listing;
+#endif
 #if MG_ENABLE_HTTP_CGI
   struct mg_http_proto_data_cgi cgi;
 #endif
@@ -5038,12 +5081,19 @@ struct mg_http_proto_data {
   struct mg_http_multipart_stream mp_stream;
 #endif
   struct mg_http_proto_data_chuncked chunk;
+#if MG_ENABLE_HTTP_WEBSOCKET
+  struct mg_http_proto_data_ws_reassembly ws_reassembly;
+#endif
   struct mg_http_endpoint *endpoints;
   mg_event_handler_t endpoint_handler;
   struct mg_reverse_proxy_data reverse_proxy_data;
 };
 
 static void mg_http_conn_destructor(void *proto_data);
+#if MG_ENABLE_FILESYSTEM && MG_ENABLE_DIRECTORY_LISTING
+static void mg_dir_listing_release(struct mg_dir_listing *l);
+static void mg_http_transfer_dir_listing(struct mg_connection *nc);
+#endif
 struct mg_connection *mg_connect_http_base(
     struct mg_mgr *mgr, mg_event_handler_t ev_handler,
     struct mg_connect_opts opts, const char *schema, const char *schema_ssl,
@@ -5114,6 +5164,9 @@ static void mg_http_conn_destructor(void *proto_data) {
 #if MG_ENABLE_FILESYSTEM
   mg_http_free_proto_data_file(&pd->file);
 #endif
+#if MG_ENABLE_FILESYSTEM && MG_ENABLE_DIRECTORY_LISTING
+  mg_dir_listing_release(pd->dir_listing.listing);
+#endif
 #if MG_ENABLE_HTTP_CGI
   mg_http_free_proto_data_cgi(&pd->cgi);
 #endif
@@ -5626,6 +5679,11 @@ void mg_http_handler(struct mg_connection *nc, int ev, void *ev_data) {
     mg_http_transfer_file_data(nc);
   }
 #endif
+#if MG_ENABLE_FILESYSTEM && MG_ENABLE_DIRECTORY_LISTING
+  if (pd->dir_listing.listing != NULL) {
+    mg_http_transfer_dir_listing(nc);
+  }
+#endif
 
   mg_call(nc, nc->handler, ev, ev_data);
 
@@ -6769,12 +6827,16 @@ static void mg_escape(const char *src, char *dst, size_t dst_len) {
 }
 
 static void mg_print_dir_entry(struct mg_connection *nc, const char *file_name,
-                               cs_stat_t *stp) {
+                               cs_stat_t *stp, void *param) {
   char size[64], mod[64], href[MAX_PATH_SIZE * 3], path[MAX_PATH_SIZE];
+  char mem[MAX_PATH_SIZE * 5], *buf = mem;
+  struct mbuf *rows = (struct mbuf *) param;
   int64_t fsize = stp->st_size;
   int is_dir = S_ISDIR(stp->st_mode);
   const char *slash = is_dir ? "/" : "";
+  int len;
 
+  (void) nc;
   if (is_dir) {
     snprintf(size, sizeof(size), "%s", "[DIRECTORY]");
   } else {
@@ -6795,17 +6857,23 @@ static void mg_print_dir_entry(struct mg_connection *nc, const char *file_name,
   strftime(mod, sizeof(mod), "%d-%b-%Y %H:%M", localtime(&stp->st_mtime));
   mg_escape(file_name, path, sizeof(path));
   mg_url_encode(file_name, strlen(file_name), href, sizeof(href));
-  mg_printf_http_chunk(nc,
-                       "<tr><td><a href=\"%s%s\">%s%s</a></td>"
-                       "<td>%s</td><td name=%" INT64_FMT ">%s</td></tr>\n",
-                       href, slash, path, slash, mod, is_dir ? -1 : fsize,
-                       size);
+  len = mg_asprintf(&buf, sizeof(mem),
+                    "<tr><td><a href=\"%s%s\">%s%s</a></td>"
+                    "<td>%s</td><td name=%" INT64_FMT ">%s</td></tr>\n",
+                    href, slash, path, slash, mod, is_dir ? -1 : fsize, size);
+  if (len > 0) {
+    mbuf_append(rows, buf, len);
+  }
+  if (buf != mem && buf != NULL) {
+    MG_FREE(buf);
+  }
 }
 
 static void mg_scan_directory(struct mg_connection *nc, const char *dir,
                               const struct mg_serve_http_opts *opts,
                               void (*func)(struct mg_connection *, const char *,
-                                           cs_stat_t *)) {
+                                           cs_stat_t *, void *),
+                              void *param) {
   char path[MAX_PATH_SIZE];
   cs_stat_t st;
   struct dirent *dp;
@@ -6820,7 +6888,7 @@ static void mg_scan_directory(struct mg_connection *nc, const char *dir,
       }
       snprintf(path, sizeof(path), "%s/%s", dir, dp->d_name);
       if (mg_stat(path, &st) == 0) {
-        func(nc, (const char *) dp->d_name, &st);
+        func(nc, (const char *) dp->d_name, &st, param);
       }
     }
     closedir(dirp);
@@ -6829,6 +6897,204 @@ static void mg_scan_directory(struct mg_connection *nc, const char *dir,
   }
 }
 
+static void mg_dir_listing_release(struct mg_dir_listing *l) {
+  if (l != NULL && --l->refcnt == 0) {
+    if (l->dirp != NULL) {
+      closedir(l->dirp);
+    }
+    mbuf_free(&l->rows);
+    MG_FREE(l->dir);
+    MG_FREE(l->hidden);
+    MG_FREE(l->auth_file);
+    MG_FREE(l);
+  }
+}
+
+MG_INTERNAL void mg_http_free_dir_listings(struct mg_mgr *mgr) {
+  struct mg_dir_listing *l, *tmp;
+
+  for (l = mgr->dir_listings; l != NULL; l = tmp) {
+    tmp = l->next;
+    mg_dir_listing_release(l);
+  }
+  mgr->dir_listings = NULL;
+}
+
+/* Compares two options that may be unset */
+static int mg_dir_listing_opt_eq(const char *cached, const char *opt) {
+  if (cached == NULL || opt == NULL) {
+    return cached == opt;
+  }
+  return strcmp(cached, opt) == 0;
+}
+
+static char *mg_dir_listing_opt_dup(const char *opt, int *failed) {
+  char *res = NULL;
+  if (opt != NULL && (res = strdup(opt)) == NULL) {
+    *failed = 1;
+  }
+  return res;
+}
+
+/*
+ * Renders the rows of the next MG_DIR_LISTING_BATCH entries of a listing, the
+ * directory is closed once all are rendered. A large directory is rendered
+ * over several events instead of blocking the event loop.
+ */
+static void mg_render_dir_listing(struct mg_connection *nc,
+                                  struct mg_dir_listing *l) {
+  struct mg_serve_http_opts opts;
+  char path[MAX_PATH_SIZE];
+  cs_stat_t st;
+  struct dirent *dp;
+  int n;
+
+  memset(&opts, 0, sizeof(opts));
+  opts.hidden_file_pattern = l->hidden;
+  opts.per_directory_auth_file = l->auth_file;
+
+  for (n = 0; n < MG_DIR_LISTING_BATCH; n++) {
+    if ((dp = readdir(l->dirp)) == NULL) {
+      closedir(l->dirp);
+      l->dirp = NULL;
+      mbuf_trim(&l->rows);
+      break;
+    }
+    /* Do not show current dir and hidden files */
+    if (mg_is_file_hidden((const char *) dp->d_name, &opts, 1)) {
+      continue;
+    }
+    snprintf(path, sizeof(path), "%s/%s", l->dir, dp->d_name);
+    if (mg_stat(path, &st) == 0) {
+      mg_print_dir_entry(nc, (const char *) dp->d_name, &st, &l->rows);
+    }
+  }
+}
+
+/*
+ * Returns the rows of `dir`, with a reference held for the caller. The rows
+ * of a listing not cached are rendered as it is streamed.
+ *
+ * The options filtering the rows are part of the key, so that servers sharing
+ * the manager with different hidden files never see each other's rows.
+ *
+ * Rows are served from the manager cache as long as the directory mtime did
+ * not change. A listing rendered during the same second as the last change is
+ * never trusted, since further changes within that second would not bump the
+ * mtime. Note that in-place modification of a file does not touch its
+ * directory, so sizes and dates of such entries may lag until the next
+ * directory change.
+ */
+static struct mg_dir_listing *mg_get_dir_listing(
+    struct mg_connection *nc, const char *dir,
+    const struct mg_serve_http_opts *opts) {
+  struct mg_dir_listing *l, **prev;
+  time_t now = (time_t) mg_time();
+  cs_stat_t st;
+  int n, failed = 0;
+
+  if (mg_stat(dir, &st) != 0) {
+    st.st_mtime = now;
+  }
+
+  for (prev = &nc->mgr->dir_listings; (l = *prev) != NULL; prev = &l->next) {
+    if (strcmp(l->dir, dir) == 0 &&
+        mg_dir_listing_opt_eq(l->hidden, opts->hidden_file_pattern) &&
+        mg_dir_listing_opt_eq(l->auth_file, opts->per_directory_auth_file)) {
+      *prev = l->next;
+      if (l->mtime == st.st_mtime && l->rendered_at > l->mtime) {
+        /* Cache hit, move to the front */
+        l->next = nc->mgr->dir_listings;
+        nc->mgr->dir_listings = l;
+        l->refcnt++;
+        return l;
+      }
+      mg_dir_listing_release(l);
+      break;
+    }
+  }
+
+  if ((l = (struct mg_dir_listing *) MG_CALLOC(1, sizeof(*l))) == NULL) {
+    return NULL;
+  }
+  l->dir = mg_dir_listing_opt_dup(dir, &failed);
+  l->hidden = mg_dir_listing_opt_dup(opts->hidden_file_pattern, &failed);
+  l->auth_file = mg_dir_listing_opt_dup(opts->per_directory_auth_file, &failed);
+  l->mtime = st.st_mtime;
+  l->rendered_at = now;
+  l->refcnt = 1;
+  mbuf_init(&l->rows, 0);
+  if (failed) {
+    mg_dir_listing_release(l);
+    return NULL;
+  }
+  if ((l->dirp = opendir(dir)) == NULL) {
+    LOG(LL_DEBUG, ("%p opendir(%s) -> %d", nc, dir, mg_get_errno()));
+  }
+
+  if (MG_DIR_LISTING_CACHE_SIZE > 0) {
+    /* Cache owns one reference, evict the least recently used listings */
+    l->refcnt++;
+    l->next = nc->mgr->dir_listings;
+    nc->mgr->dir_listings = l;
+    for (n = 0, prev = &l->next; *prev != NULL; n++) {
+      if (n + 1 >= MG_DIR_LISTING_CACHE_SIZE) {
+        struct mg_dir_listing *old = *prev;
+        *prev = old->next;
+        mg_dir_listing_release(old);
+      } else {
+        prev = &(*prev)->next;
+      }
+    }
+  }
+
+  return l;
+}
+
+/*
+ * Streams the rows of the listing attached to the connection, at most
+ * MG_MAX_HTTP_SEND_MBUF bytes in flight at a time, then sends the footer.
+ * More rows are rendered once the ones rendered are sent.
+ */
+static void mg_http_transfer_dir_listing(struct mg_connection *nc) {
+  struct mg_http_proto_data *pd = mg_http_get_proto_data(nc);
+  struct mg_http_proto_data_dir_listing *d = &pd->dir_listing;
+  struct mbuf *rows = &d->listing->rows;
+  size_t to_send = 0;
+
+  if (nc->flags & (MG_F_CLOSE_IMMEDIATELY | MG_F_SEND_AND_CLOSE)) {
+    return;
+  }
+
+  if (d->sent >= rows->len && d->listing->dirp != NULL) {
+    mg_render_dir_listing(nc, d->listing);
+  }
+
+  if (nc->send_mbuf.len < MG_MAX_HTTP_SEND_MBUF) {
+    to_send = MIN(rows->len - d->sent,
+                  MG_MAX_HTTP_SEND_MBUF - nc->send_mbuf.len);
+  }
+
+  if (to_send > 0) {
+    mg_send_http_chunk(nc, rows->buf + d->sent, to_send);
+    d->sent += to_send;
+  } else if (d->sent >= rows->len && d->listing->dirp == NULL) {
+    mg_printf_http_chunk(nc,
+                         "</tbody><tr><td colspan=3><hr></td></tr>\n"
+                         "</table>\n"
+                         "<address>%s</address>\n"
+                         "</body></html>",
+                         mg_version_header);
+    mg_send_http_chunk(nc, "", 0);
+    mg_dir_listing_release(d->listing);
+    memset(d, 0, sizeof(*d));
+    /* TODO(rojer): Remove when cesanta/dev/issues/197 is fixed. */
+    nc->flags |= MG_F_SEND_AND_CLOSE;
+  } else {
+    /* Rate limiting. send_mbuf is too full, wait until it's drained. */
+  }
+}
+
 static void mg_send_directory_listing(struct mg_connection *nc, const char *dir,
                                       struct http_message *hm,
                                       struct mg_serve_http_opts *opts) {
@@ -6855,6 +7121,13 @@ static void mg_send_directory_listing(struct mg_connection *nc, const char *dir,
       "srt(tb, sc, so, true);"
       "}"
       "</script>";
+  struct mg_http_proto_data *pd = mg_http_get_proto_data(nc);
+  struct mg_dir_listing *listing = mg_get_dir_listing(nc, dir, opts);
+
+  if (listing == NULL) {
+    mg_http_send_error(nc, 500, NULL);
+    return;
+  }
 
   mg_send_response_line(nc, 200, opts->extra_headers);
   mg_printf(nc, "%s: %s\r\n%s: %s\r\n\r\n", "Transfer-Encoding", "chunked",
@@ -6874,16 +7147,12 @@ static void mg_send_directory_listing(struct mg_connection *nc, const char *dir,
       "<tbody id=tb>",
       (int) hm->uri.len, hm->uri.p, sort_js_code, sort_js_code2,
       (int) hm->uri.len, hm->uri.p);
-  mg_scan_directory(nc, dir, opts, mg_print_dir_entry);
-  mg_printf_http_chunk(nc,
-                       "</tbody><tr><td colspan=3><hr></td></tr>\n"
-                       "</table>\n"
-                       "<address>%s</address>\n"
-                       "</body></html>",
-                       mg_version_header);
-  mg_send_http_chunk(nc, "", 0);
-  /* TODO(rojer): Remove when cesanta/dev/issues/197 is fixed. */
-  nc->flags |= MG_F_SEND_AND_CLOSE;
+
+  /* Rows are streamed by mg_http_transfer_dir_listing as send_mbuf drains */
+  mg_dir_listing_release(pd->dir_listing.listing);
+  pd->dir_listing.listing = listing;
+  pd->dir_listing.sent = 0;
+  mg_http_transfer_dir_listing(nc);
 }
 #endif /* MG_ENABLE_DIRECTORY_LISTING */
 
@@ -8556,9 +8825,10 @@ static int mg_mkdir(const char *path, uint32_t mode) {
 }
 
 static void mg_print_props(struct mg_connection *nc, const char *name,
-                           cs_stat_t *stp) {
+                           cs_stat_t *stp, void *param) {
   char mtime[64], buf[MAX_PATH_SIZE * 3];
   time_t t = stp->st_mtime; /* store in local variable for NDK compile */
+  (void) param;
   mg_gmt_time_string(mtime, sizeof(mtime), &t);
   mg_url_encode(name, strlen(name), buf, sizeof(buf));
   mg_printf(nc,
@@ -8598,9 +8868,9 @@ MG_INTERNAL void mg_handle_propfind(struct mg_connection *nc, const char *path,
     char uri[MAX_PATH_SIZE];
     mg_send(nc, header, sizeof(header) - 1);
     snprintf(uri, sizeof(uri), "%.*s", (int) hm->uri.len, hm->uri.p);
-    mg_print_props(nc, uri, stp);
+    mg_print_props(nc, uri, stp, NULL);
     if (S_ISDIR(stp->st_mode) && (depth == NULL || mg_vcmp(depth, "0") != 0)) {
-      mg_scan_directory(nc, path, opts, mg_print_props);
+      mg_scan_directory(nc, path, opts, mg_print_props, NULL);
     }
     mg_send(nc, footer, sizeof(footer) - 1);
     nc->flags |= MG_F_SEND_AND_CLOSE;
@@ -8799,12 +9069,82 @@ MG_INTERNAL void mg_handle_put(struct mg_connection *nc, const char *path,
 
 #define MG_WS_NO_HOST_HEADER_MAGIC ((char *) 0x1)
 
-static int mg_is_ws_fragment(unsigned char flags) {
-  return (flags & 0x80) == 0 || (flags & 0x0f) == 0;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    defined(__SSE2__)
+#define MG_WS_MASK_SSE2 1
+#include <emmintrin.h>
+#if __GNUC__ >= 5 || defined(__clang__)
+#define MG_WS_MASK_AVX2 1
+#include <immintrin.h>
+#endif
+#elif defined(_MSC_VER) && \
+    (defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define MG_WS_MASK_SSE2 1
+#include <emmintrin.h>
+#endif
+
+/*
+ * Masking kernels: each XORs the data from `i` with the key replicated over
+ * its width, and returns where it stopped. The widths are multiples of 4, so
+ * the key is always in phase where the next kernel starts.
+ */
+#ifdef MG_WS_MASK_AVX2
+__attribute__((target("avx2"))) static size_t mg_ws_mask_avx2(
+    unsigned char *data, size_t len, uint32_t key, size_t i) {
+  __m256i k = _mm256_set1_epi32((int) key);
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((__m256i *) (data + i));
+    _mm256_storeu_si256((__m256i *) (data + i), _mm256_xor_si256(v, k));
+  }
+  return i;
+}
+#endif
+
+#ifdef MG_WS_MASK_SSE2
+static size_t mg_ws_mask_sse2(unsigned char *data, size_t len, uint32_t key,
+                              size_t i) {
+  __m128i k = _mm_set1_epi32((int) key);
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((__m128i *) (data + i));
+    _mm_storeu_si128((__m128i *) (data + i), _mm_xor_si128(v, k));
+  }
+  return i;
 }
+#endif
+
+static size_t mg_ws_mask_scalar(unsigned char *data, size_t len, uint32_t key,
+                                size_t i) {
+  uint64_t k, v;
+  memcpy(&k, &key, 4);
+  memcpy((char *) &k + 4, &key, 4);
+  for (; i + 8 <= len; i += 8) {
+    memcpy(&v, data + i, 8);
+    v ^= k;
+    memcpy(data + i, &v, 8);
+  }
+  return i;
+}
+
+/* Masks or unmasks `len` bytes with the 4 bytes of `mask`, in place */
+static void mg_ws_mask(unsigned char *data, size_t len,
+                       const unsigned char *mask) {
+  uint32_t key;
+  size_t i = 0;
 
-static int mg_is_ws_first_fragment(unsigned char flags) {
-  return (flags & 0x80) == 0 && (flags & 0x0f) != 0;
+  /* Read in memory order, so that lane j of a vector gets mask[j % 4] */
+  memcpy(&key, mask, 4);
+#ifdef MG_WS_MASK_AVX2
+  if (len >= 64 && __builtin_cpu_supports("avx2")) {
+    i = mg_ws_mask_avx2(data, len, key, i);
+  }
+#endif
+#ifdef MG_WS_MASK_SSE2
+  i = mg_ws_mask_sse2(data, len, key, i);
+#endif
+  i = mg_ws_mask_scalar(data, len, key, i);
+  for (; i < len; i++) {
+    data[i] ^= mask[i % 4];
+  }
 }
 
 static void mg_handle_incoming_websocket_frame(struct mg_connection *nc,
@@ -8816,90 +9156,133 @@ static void mg_handle_incoming_websocket_frame(struct mg_connection *nc,
   }
 }
 
-static int mg_deliver_websocket_data(struct mg_connection *nc) {
-  /* Using unsigned char *, cause of integer arithmetic below */
-  uint64_t i, data_len = 0, frame_len = 0, buf_len = nc->recv_mbuf.len, len,
-              mask_len = 0, header_len = 0;
-  unsigned char *p = (unsigned char *) nc->recv_mbuf.buf, *buf = p,
-                *e = p + buf_len;
-  unsigned *sizep = (unsigned *) &p[1]; /* Size ptr for defragmented frames */
-  int ok, reass = buf_len > 0 && mg_is_ws_fragment(p[0]) &&
-                  !(nc->flags & MG_F_WEBSOCKET_NO_DEFRAG);
-
-  /* If that's a continuation frame that must be reassembled, handle it */
-  if (reass && !mg_is_ws_first_fragment(p[0]) &&
-      buf_len >= 1 + sizeof(*sizep) && buf_len >= 1 + sizeof(*sizep) + *sizep) {
-    buf += 1 + sizeof(*sizep) + *sizep;
-    buf_len -= 1 + sizeof(*sizep) + *sizep;
-  }
+/*
+ * Parses the header of the frame at buf, returns its size, or 0 if it is not
+ * complete
+ */
+static uint64_t mg_parse_ws_header(const unsigned char *buf, uint64_t buf_len,
+                                   uint64_t *data_len, uint64_t *mask_len) {
+  uint64_t len, header_len = 0;
 
+  *data_len = 0;
   if (buf_len >= 2) {
     len = buf[1] & 127;
-    mask_len = buf[1] & 128 ? 4 : 0;
-    if (len < 126 && buf_len >= mask_len) {
-      data_len = len;
-      header_len = 2 + mask_len;
-    } else if (len == 126 && buf_len >= 4 + mask_len) {
-      header_len = 4 + mask_len;
-      data_len = ntohs(*(uint16_t *) &buf[2]);
-    } else if (buf_len >= 10 + mask_len) {
-      header_len = 10 + mask_len;
-      data_len = (((uint64_t) ntohl(*(uint32_t *) &buf[2])) << 32) +
-                 ntohl(*(uint32_t *) &buf[6]);
+    *mask_len = buf[1] & 128 ? 4 : 0;
+    if (len < 126 && buf_len >= 2 + *mask_len) {
+      *data_len = len;
+      header_len = 2 + *mask_len;
+    } else if (len == 126 && buf_len >= 4 + *mask_len) {
+      header_len = 4 + *mask_len;
+      *data_len = ntohs(*(uint16_t *) &buf[2]);
+    } else if (len == 127 && buf_len >= 10 + *mask_len) {
+      header_len = 10 + *mask_len;
+      *data_len = (((uint64_t) ntohl(*(uint32_t *) &buf[2])) << 32) +
+                  ntohl(*(uint32_t *) &buf[6]);
     }
   }
 
-  frame_len = header_len + data_len;
-  ok = frame_len > 0 && frame_len <= buf_len;
-
-  if (ok) {
-    struct websocket_message wsm;
+  return header_len;
+}
 
-    wsm.size = (size_t) data_len;
-    wsm.data = buf + header_len;
-    wsm.flags = buf[0];
+/*
+ * Moves the payloads of the data frames of a fragmented message next to each
+ * other at the start of the buffer, each byte is moved once
+ */
+static void mg_gather_ws_fragments(unsigned char *p, uint64_t len) {
+  unsigned char *dst = p;
+  uint64_t pos = 0, header_len, data_len, mask_len;
 
-    /* Apply mask if necessary */
-    if (mask_len > 0) {
-      for (i = 0; i < data_len; i++) {
-        buf[i + header_len] ^= (buf + header_len - mask_len)[i % 4];
-      }
+  while (pos < len) {
+    header_len = mg_parse_ws_header(p + pos, len - pos, &data_len, &mask_len);
+    /* Control frames were delivered as they came */
+    if (!(p[pos] & 0x8)) {
+      memmove(dst, p + pos + header_len, (size_t) data_len);
+      dst += data_len;
     }
+    pos += header_len + data_len;
+  }
+}
 
-    if (reass) {
-      /* On first fragmented frame, nullify size */
-      if (mg_is_ws_first_fragment(wsm.flags)) {
-        mbuf_resize(&nc->recv_mbuf, nc->recv_mbuf.size + sizeof(*sizep));
-        p[0] &= ~0x0f; /* Next frames will be treated as continuation */
-        buf = p + 1 + sizeof(*sizep);
-        *sizep = 0; /* TODO(lsm): fix. this can stomp over frame data */
-      }
+static int mg_deliver_websocket_data(struct mg_connection *nc) {
+  struct mg_http_proto_data_ws_reassembly *ra =
+      &mg_http_get_proto_data(nc)->ws_reassembly;
+  /* The frames of a message being reassembled are skipped */
+  uint64_t offset = ra->flags != 0 ? ra->len : 0, data_len = 0, mask_len = 0,
+           header_len, frame_len;
+  unsigned char *buf = (unsigned char *) nc->recv_mbuf.buf + offset;
+  uint64_t buf_len = nc->recv_mbuf.len - offset;
+  struct websocket_message wsm;
+  unsigned char flags;
+
+  header_len = mg_parse_ws_header(buf, buf_len, &data_len, &mask_len);
+  if (header_len == 0) {
+    return 0;
+  }
+  /* RFC 6455 forbids the most significant bit of a 64-bit length */
+  if (data_len >> 63) {
+    nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+    return 0;
+  }
+  /* Compared without adding, a huge length would wrap the frame size */
+  if (data_len > buf_len - header_len) {
+    return 0;
+  }
+  frame_len = header_len + data_len;
 
-      /* Append this frame to the reassembled buffer */
-      memmove(buf, wsm.data, e - wsm.data);
-      (*sizep) += wsm.size;
-      nc->recv_mbuf.len -= wsm.data - buf;
+  flags = buf[0];
+  wsm.size = (size_t) data_len;
+  wsm.data = buf + header_len;
+  wsm.flags = flags;
 
-      /* On last fragmented frame - call user handler and remove data */
-      if (wsm.flags & 0x80) {
-        wsm.data = p + 1 + sizeof(*sizep);
-        wsm.size = *sizep;
-        mg_handle_incoming_websocket_frame(nc, &wsm);
-        mbuf_remove(&nc->recv_mbuf, 1 + sizeof(*sizep) + *sizep);
-      }
+  /* Apply mask if necessary */
+  if (mask_len > 0) {
+    mg_ws_mask(buf + header_len, (size_t) data_len,
+               buf + header_len - mask_len);
+  }
+
+  /* A continuation out of a message, or a message within a message */
+  if (!(flags & 0x8) && !(nc->flags & MG_F_WEBSOCKET_NO_DEFRAG) &&
+      (ra->flags == 0) == ((flags & 0x0f) == 0)) {
+    nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+    return 0;
+  }
+
+  if ((flags & 0x8) || (nc->flags & MG_F_WEBSOCKET_NO_DEFRAG) ||
+      (ra->flags == 0 && (flags & 0x80))) {
+    /* Control frames can come between the fragments of a message */
+    mg_handle_incoming_websocket_frame(nc, &wsm);
+    if (ra->flags != 0) {
+      ra->len += (size_t) frame_len;
     } else {
-      /* TODO(lsm): properly handle OOB control frames during defragmentation */
-      mg_handle_incoming_websocket_frame(nc, &wsm);
       mbuf_remove(&nc->recv_mbuf, (size_t) frame_len); /* Cleanup frame */
     }
-
-    /* If client closes, close too */
-    if ((buf[0] & 0x0f) == WEBSOCKET_OP_CLOSE) {
-      nc->flags |= MG_F_SEND_AND_CLOSE;
+  } else {
+    if (ra->flags == 0) {
+      ra->flags = flags;
+      ra->len = ra->size = 0;
+    }
+    ra->len += (size_t) frame_len;
+    ra->size += (size_t) data_len;
+
+    /* On last fragmented frame - call user handler and remove data */
+    if (flags & 0x80) {
+      mg_gather_ws_fragments((unsigned char *) nc->recv_mbuf.buf, ra->len);
+      wsm.data = (unsigned char *) nc->recv_mbuf.buf;
+      wsm.size = ra->size;
+      /* The opcode and the extensions flags (RSV bits) are on the first */
+      wsm.flags = 0x80 | (ra->flags & 0x7f);
+      ra->flags = 0;
+      mg_handle_incoming_websocket_frame(nc, &wsm);
+      mbuf_remove(&nc->recv_mbuf, ra->len);
     }
   }
 
-  return ok;
+  /* If client closes, close too */
+  if ((flags & 0x0f) == WEBSOCKET_OP_CLOSE) {
+    nc->flags |= MG_F_SEND_AND_CLOSE;
+  }
+
+  return 1;
 }
 
 struct ws_mask_ctx {
@@ -8973,11 +9356,9 @@ static void mg_send_ws_header(struct mg_connection *nc, int op, size_t len,
 }
 
 static void mg_ws_mask_frame(struct mbuf *mbuf, struct ws_mask_ctx *ctx) {
-  size_t i;
   if (ctx->pos == 0) return;
-  for (i = 0; i < (mbuf->len - ctx->pos); i++) {
-    mbuf->buf[ctx->pos + i] ^= ((char *) &ctx->mask)[i % 4];
-  }
+  mg_ws_mask((unsigned char *) mbuf->buf + ctx->pos, mbuf->len - ctx->pos,
+             (const unsigned char *) &ctx->mask);
 }
 
 void mg_send_websocket_frame(struct mg_connection *nc, int op, const void *data,
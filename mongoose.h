@@ -3257,6 +3257,9 @@ struct mg_mgr {
 #if MG_ENABLE_JAVASCRIPT
   struct v7 *v7;
 #endif
+#if MG_ENABLE_HTTP && MG_ENABLE_FILESYSTEM && MG_ENABLE_DIRECTORY_LISTING
+  struct mg_dir_listing *dir_listings; /* Rendered directory listings */
+#endif
 };
 
 /*
@@ -4064,6 +4067,16 @@ extern "C" {
 #define MG_MAX_HTTP_SEND_MBUF 1024
 #endif
 
+/* Number of rendered directory listings kept per manager, 0 disables */
+#ifndef MG_DIR_LISTING_CACHE_SIZE
+#define MG_DIR_LISTING_CACHE_SIZE 16
+#endif
+
+/* Number of directory entries a listing renders per connection event */
+#ifndef MG_DIR_LISTING_BATCH
+#define MG_DIR_LISTING_BATCH 64
+#endif
+
 #ifndef MG_CGI_ENVIRONMENT_SIZE
 #define MG_CGI_ENVIRONMENT_SIZE 8192
 #endif
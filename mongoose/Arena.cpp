@@ -0,0 +1,68 @@
+#include <stdlib.h>
+#include "Arena.h"
+
+using namespace std;
+
+namespace Mongoose
+{
+    Arena::Arena(char *storage_, size_t size)
+        : storage(storage_), storageSize(size), blocks(NULL)
+    {
+        reset();
+    }
+
+    Arena::~Arena()
+    {
+        reset();
+    }
+
+    size_t Arena::align(size_t size)
+    {
+        const size_t alignment = sizeof(double) > sizeof(void *) ? sizeof(double) : sizeof(void *);
+
+        return (size + alignment - 1) & ~(alignment - 1);
+    }
+
+    void *Arena::allocate(size_t size)
+    {
+        size = align(size);
+
+        // The initial storage may not be aligned, the blocks are
+        char *pointer = (char *) align((size_t) current);
+
+        if (current == NULL || pointer + size > end) {
+            size_t blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+            Block *block = (Block *) malloc(sizeof(Block) + blockSize);
+
+            if (block == NULL) {
+                throw bad_alloc();
+            }
+            block->next = blocks;
+            blocks = block;
+            pointer = (char *) (block + 1);
+            end = pointer + blockSize;
+        }
+        current = pointer + size;
+
+        return pointer;
+    }
+
+    void Arena::deallocate(void *pointer, size_t size)
+    {
+        if ((char *) pointer + align(size) == current) {
+            current = (char *) pointer;
+        }
+    }
+
+    void Arena::reset()
+    {
+        while (blocks != NULL) {
+            Block *next = blocks->next;
+            free(blocks);
+            blocks = next;
+        }
+
+        current = storage;
+        end = storage + storageSize;
+    }
+}
@@ -0,0 +1,138 @@
+#ifndef _MONGOOSE_ARENA_H
+#define _MONGOOSE_ARENA_H
+
+#include <stddef.h>
+#include <new>
+#include <string>
+
+#define ARENA_BLOCK_SIZE 4096
+
+using namespace std;
+
+/**
+ * A monotonic allocator for the objects living as long as a request
+ *
+ * Memory is taken from an initial storage, usually a member of the owner,
+ * then from heap blocks. Nothing is freed before the arena is reset or
+ * destroyed, so the containers of a request or a response cost no
+ * allocation at all while they fit in the initial storage
+ */
+namespace Mongoose
+{
+    class Arena
+    {
+        public:
+            /**
+             * Creates an arena
+             *
+             * @param char* the initial storage, it must outlive the arena
+             * @param size_t the size of the initial storage
+             */
+            Arena(char *storage = NULL, size_t size = 0);
+            virtual ~Arena();
+
+            /**
+             * Allocates memory, aligned for any type
+             *
+             * @param size_t the size to allocate
+             *
+             * @return void* the memory, valid until the arena is reset
+             */
+            void *allocate(size_t size);
+
+            /**
+             * Gives memory back, this only does something for the last
+             * allocation, which lets a buffer that grows reuse its space
+             *
+             * @param void* the memory
+             * @param size_t its size
+             */
+            void deallocate(void *pointer, size_t size);
+
+            /**
+             * Releases everything allocated at once, the heap blocks are freed
+             */
+            void reset();
+
+        protected:
+            struct Block
+            {
+                Block *next;
+                double padding;
+            };
+
+            static size_t align(size_t size);
+
+            char *storage;
+            size_t storageSize;
+            char *current;
+            char *end;
+            Block *blocks;
+
+        private:
+            Arena(const Arena &);
+            Arena &operator=(const Arena &);
+    };
+
+    /**
+     * Standard allocator taking its memory from an Arena, without arena it
+     * uses the heap
+     */
+    template<typename T>
+    class ArenaAllocator
+    {
+        public:
+            typedef T value_type;
+            typedef T *pointer;
+            typedef const T *const_pointer;
+            typedef T &reference;
+            typedef const T &const_reference;
+            typedef size_t size_type;
+            typedef ptrdiff_t difference_type;
+
+            template<typename U>
+            struct rebind
+            {
+                typedef ArenaAllocator<U> other;
+            };
+
+            ArenaAllocator(Arena *arena_ = NULL) throw() : arena(arena_) {}
+
+            template<typename U>
+            ArenaAllocator(const ArenaAllocator<U> &other) throw() : arena(other.arena) {}
+
+            pointer address(reference value) const { return &value; }
+            const_pointer address(const_reference value) const { return &value; }
+
+            pointer allocate(size_type count, const void * = 0)
+            {
+                if (arena == NULL) {
+                    return (pointer) ::operator new(count * sizeof(T));
+                }
+                return (pointer) arena->allocate(count * sizeof(T));
+            }
+
+            void deallocate(pointer pointer_, size_type count)
+            {
+                if (arena == NULL) {
+                    ::operator delete(pointer_);
+                } else {
+                    arena->deallocate(pointer_, count * sizeof(T));
+                }
+            }
+
+            size_type max_size() const throw() { return ((size_type) -1) / sizeof(T); }
+
+            void construct(pointer pointer_, const T &value) { new ((void *) pointer_) T(value); }
+            void destroy(pointer pointer_) { pointer_->~T(); }
+
+            bool operator==(const ArenaAllocator &other) const { return arena == other.arena; }
+            bool operator!=(const ArenaAllocator &other) const { return arena != other.arena; }
+
+            Arena *arena;
+    };
+
+    typedef basic_string<char, char_traits<char>, ArenaAllocator<char> > arena_string;
+}
+
+#endif
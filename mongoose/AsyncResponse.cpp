@@ -0,0 +1,171 @@
+#include "AsyncResponse.h"
+#include "Server.h"
+
+using namespace std;
+
+namespace Mongoose
+{
+    /**
+     * Polls the response of a completed handle on the poll thread
+     */
+    class CompleteTask : public ServerTask
+    {
+        public:
+            CompleteTask(struct mg_connection *connection_)
+                : connection(connection_)
+            {
+            }
+
+            void run(Server *server)
+            {
+                server->_pollResponse(connection);
+            }
+
+        protected:
+            struct mg_connection *connection;
+    };
+
+    ResponseHandle::ResponseHandle(Server *server_, Response *response_)
+        : server(server_), response(response_), connection(NULL),
+        references(2), completed(false), abandoned(false)
+    {
+    }
+
+    ResponseHandle::~ResponseHandle()
+    {
+        if (response != NULL) {
+            delete response;
+        }
+    }
+
+    void ResponseHandle::release()
+    {
+        mutex.lock();
+        bool last = (--references == 0);
+        mutex.unlock();
+
+        if (last) {
+            delete this;
+        }
+    }
+
+    void ResponseHandle::finish()
+    {
+        completed = true;
+        if (!abandoned && connection != NULL) {
+            // The connection can not be closed while we hold the lock, the
+            // task is dropped by _pollResponse if it is closed before it runs
+            server->post(new CompleteTask(connection));
+        }
+    }
+
+    void ResponseHandle::complete()
+    {
+        mutex.lock();
+        finish();
+        mutex.unlock();
+
+        release();
+    }
+
+    void ResponseHandle::complete(Response *response_)
+    {
+        mutex.lock();
+        if (response != NULL && response != response_) {
+            delete response;
+        }
+        response = response_;
+        finish();
+        mutex.unlock();
+
+        release();
+    }
+
+    bool ResponseHandle::isAbandoned()
+    {
+        mutex.lock();
+        bool result = abandoned;
+        mutex.unlock();
+
+        return result;
+    }
+
+    Response *ResponseHandle::_takeResponse()
+    {
+        Response *result = NULL;
+
+        mutex.lock();
+        if (completed) {
+            result = response;
+            response = NULL;
+        }
+        mutex.unlock();
+
+        return result;
+    }
+
+    void ResponseHandle::_abandon()
+    {
+        mutex.lock();
+        abandoned = true;
+        connection = NULL;
+        mutex.unlock();
+
+        release();
+    }
+
+    void ResponseHandle::_drop()
+    {
+        release();
+    }
+
+    void ResponseHandle::_setConnection(struct mg_connection *connection_)
+    {
+        mutex.lock();
+        connection = connection_;
+        mutex.unlock();
+    }
+
+    AsyncResponse::AsyncResponse(ResponseHandle *handle_)
+        : handle(handle_), response(NULL)
+    {
+    }
+
+    AsyncResponse::~AsyncResponse()
+    {
+        handle->_abandon();
+
+        if (response != NULL) {
+            delete response;
+        }
+    }
+
+    string AsyncResponse::getBody()
+    {
+        return response != NULL ? response->getBody() : "";
+    }
+
+    void AsyncResponse::write(struct mg_connection *connection)
+    {
+        handle->_setConnection(connection);
+        poll(connection);
+    }
+
+    bool AsyncResponse::isComplete()
+    {
+        return response != NULL && response->isComplete();
+    }
+
+    void AsyncResponse::poll(struct mg_connection *connection)
+    {
+        if (response == NULL) {
+            response = handle->_takeResponse();
+
+            if (response != NULL) {
+                response->write(connection);
+            }
+        } else {
+            response->poll(connection);
+        }
+    }
+}
@@ -0,0 +1,132 @@
+#ifndef _MONGOOSE_ASYNC_RESPONSE_H
+#define _MONGOOSE_ASYNC_RESPONSE_H
+
+#include <string>
+#include <mongoose.h>
+
+#include "Response.h"
+#include "Mutex.h"
+
+using namespace std;
+
+/**
+ * Deferred responses
+ *
+ * An asynchronous handler gets its response along with a ResponseHandle, it
+ * can fill the response later, from any thread, and then call complete()
+ * on the handle. The response is then written on the poll thread.
+ *
+ * Note that the Request is only valid during the handler call, data that
+ * is needed later has to be copied. If the handler throws, the error response
+ * is sent instead and the handle is released, it must not be used anymore.
+ */
+namespace Mongoose
+{
+    class Server;
+
+    class ResponseHandle
+    {
+        public:
+            /**
+             * Creates a handle, the handle takes the ownership of the response
+             *
+             * @param Server* the server writing the response
+             * @param Response* the response to complete
+             */
+            ResponseHandle(Server *server, Response *response);
+
+            /**
+             * Hands the response back to the server, the handle and the
+             * response must not be used anymore after this call
+             */
+            void complete();
+
+            /**
+             * Completes the handle with another response, the handle takes
+             * the ownership of it and deletes the previous one
+             *
+             * @param Response* the response to send
+             */
+            void complete(Response *response);
+
+            /**
+             * Is the client gone? Completing an abandoned handle only frees
+             * it, so a long operation can be stopped early
+             *
+             * @return bool true if the response will never be sent
+             */
+            bool isAbandoned();
+
+            /**
+             * Internally used by the server to get the response once the
+             * handle is completed
+             *
+             * @return Response* the response, or NULL if not completed yet
+             */
+            Response *_takeResponse();
+
+            /**
+             * Internally used by the server to release its reference when
+             * the connection is closed
+             */
+            void _abandon();
+
+            /**
+             * Internally used to release the reference of a handler that
+             * threw, or of a task dropped at shutdown, instead of completing
+             * the handle
+             */
+            void _drop();
+
+            /**
+             * Internally used to set the connection the response goes to
+             *
+             * @param struct mg_connection* the connection
+             */
+            void _setConnection(struct mg_connection *connection);
+
+        protected:
+            virtual ~ResponseHandle();
+
+            /**
+             * Drops a reference, the handle is deleted with the last one
+             */
+            void release();
+
+            /**
+             * Marks the handle completed and wakes the poll thread up, the
+             * mutex must be held
+             */
+            void finish();
+
+            Mutex mutex;
+            Server *server;
+            Response *response;
+            struct mg_connection *connection;
+            int references;
+            bool completed;
+            bool abandoned;
+    };
+
+    /**
+     * The response the server keeps for a connection while the handle is
+     * not completed
+     */
+    class AsyncResponse : public Response
+    {
+        public:
+            AsyncResponse(ResponseHandle *handle);
+            virtual ~AsyncResponse();
+
+            virtual string getBody();
+            virtual void write(struct mg_connection *connection);
+            virtual bool isComplete();
+            virtual void poll(struct mg_connection *connection);
+
+        protected:
+            ResponseHandle *handle;
+            Response *response;
+    };
+}
+
+#endif
@@ -0,0 +1,120 @@
+#include "ChunkedResponse.h"
+
+using namespace std;
+
+namespace Mongoose
+{
+    ChunkedResponse::Buffer::Buffer(ChunkedResponse *response_)
+        : response(response_)
+    {
+        setp(data, data + sizeof(data));
+    }
+
+    int ChunkedResponse::Buffer::overflow(int c)
+    {
+        sync();
+
+        if (c != EOF) {
+            *pptr() = c;
+            pbump(1);
+        }
+
+        return (c == EOF) ? 0 : c;
+    }
+
+    int ChunkedResponse::Buffer::sync()
+    {
+        if (pptr() > pbase()) {
+            response->sendChunk(pbase(), pptr() - pbase());
+            setp(data, data + sizeof(data));
+        }
+
+        return 0;
+    }
+
+    ChunkedResponse::ChunkedResponse(size_t highWaterMark_)
+        : ostream(NULL), buffer(this), connection(NULL), producer(NULL),
+        highWaterMark(highWaterMark_), complete(false)
+    {
+        rdbuf(&buffer);
+    }
+
+    ChunkedResponse::~ChunkedResponse()
+    {
+        if (producer != NULL) {
+            delete producer;
+        }
+    }
+
+    void ChunkedResponse::setProducer(ChunkProducer *producer_)
+    {
+        if (producer != NULL) {
+            delete producer;
+        }
+        producer = producer_;
+    }
+
+    bool ChunkedResponse::canWrite()
+    {
+        return connection == NULL || connection->send_mbuf.len < highWaterMark;
+    }
+
+    string ChunkedResponse::getBody()
+    {
+        buffer.pubsync();
+
+        return pending;
+    }
+
+    void ChunkedResponse::sendChunk(const char *data, size_t size)
+    {
+        if (connection == NULL) {
+            pending.append(data, size);
+        } else {
+            mg_send_http_chunk(connection, data, size);
+        }
+    }
+
+    void ChunkedResponse::write(struct mg_connection *connection_)
+    {
+        buffer.pubsync();
+
+        writeHead(connection_, 0, true);
+        connection = connection_;
+        if (!pending.empty()) {
+            sendChunk(pending.data(), pending.size());
+            string().swap(pending);
+        }
+
+        poll(connection);
+    }
+
+    bool ChunkedResponse::isComplete()
+    {
+        return complete;
+    }
+
+    void ChunkedResponse::poll(struct mg_connection *connection_)
+    {
+        if (complete || !canWrite()) {
+            return;
+        }
+
+        try {
+            if (producer != NULL && producer->produce(*this)) {
+                buffer.pubsync();
+                return;
+            }
+        } catch (...) {
+            // Headers are already sent, the only way to signal the error
+            // is to drop the connection before the last chunk
+            complete = true;
+            connection_->flags |= MG_F_CLOSE_IMMEDIATELY;
+            return;
+        }
+
+        buffer.pubsync();
+        mg_send_http_chunk(connection, "", 0);
+        complete = true;
+    }
+}
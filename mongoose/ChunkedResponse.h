@@ -0,0 +1,115 @@
+#ifndef _MONGOOSE_CHUNKED_RESPONSE_H
+#define _MONGOOSE_CHUNKED_RESPONSE_H
+
+#include <string>
+#include <iostream>
+#include <mongoose.h>
+
+#include "Response.h"
+
+#define CHUNKED_BUFFER_SIZE 4096
+#define CHUNKED_HIGH_WATER_MARK 65536
+
+using namespace std;
+
+/**
+ * A response streamed to the client with Transfer-Encoding: chunked
+ *
+ * What is written in the handler is sent when the handler returns, then
+ * the producer (if any) is called again each time the connection can take
+ * more data, until it tells it is done. This keeps the memory used per
+ * response bounded by the high water mark of the send queue.
+ */
+namespace Mongoose
+{
+    class ChunkedResponse;
+
+    /**
+     * Produces the body of a chunked response piece by piece
+     */
+    class ChunkProducer
+    {
+        public:
+            virtual ~ChunkProducer() {}
+
+            /**
+             * Called each time the connection can take more data, the
+             * producer should write until canWrite() becomes false
+             *
+             * @param ChunkedResponse the response to write to
+             *
+             * @return bool true if there is more to produce, false when done
+             */
+            virtual bool produce(ChunkedResponse &response)=0;
+    };
+
+    class ChunkedResponse : public ostream, public Response
+    {
+        public:
+            /**
+             * Creates a chunked response, the producer is paused while more
+             * than highWaterMark bytes are waiting to be sent
+             */
+            ChunkedResponse(size_t highWaterMark = CHUNKED_HIGH_WATER_MARK);
+            virtual ~ChunkedResponse();
+
+            /**
+             * Sets the producer of the rest of the body, the response takes
+             * the ownership of it
+             *
+             * @param ChunkProducer* the producer
+             */
+            void setProducer(ChunkProducer *producer);
+
+            /**
+             * Can the producer write more without going above the high
+             * water mark?
+             *
+             * @return bool true if more data can be written
+             */
+            bool canWrite();
+
+            /**
+             * Gets the data written before the response was sent
+             *
+             * @return string the response body
+             */
+            virtual string getBody();
+
+            virtual void write(struct mg_connection *connection);
+            virtual bool isComplete();
+            virtual void poll(struct mg_connection *connection);
+
+        protected:
+            /**
+             * Stream buffer that turns each flush into a chunk
+             */
+            class Buffer : public streambuf
+            {
+                public:
+                    Buffer(ChunkedResponse *response);
+
+                protected:
+                    virtual int overflow(int c);
+                    virtual int sync();
+
+                    ChunkedResponse *response;
+                    char data[CHUNKED_BUFFER_SIZE];
+            };
+
+            /**
+             * Sends the given data as a chunk, or keep it until the response
+             * is written
+             */
+            void sendChunk(const char *data, size_t size);
+
+            Buffer buffer;
+            string pending;
+            struct mg_connection *connection;
+            ChunkProducer *producer;
+            size_t highWaterMark;
+            bool complete;
+    };
+}
+
+#endif
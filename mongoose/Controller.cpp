@@ -1,13 +1,49 @@
 #include <iostream>
 #include "Controller.h"
 #include "StreamResponse.h"
+#include "Server.h"
 
 using namespace std;
 
 namespace Mongoose
 {
+    /**
+     * Runs a route handler on a worker with a detached copy of the request
+     */
+    class OffloadTask : public ExecutorTask
+    {
+        public:
+            OffloadTask(RequestHandlerBase *handler_, Request *request_, ResponseHandle *handle_)
+                : handler(handler_), request(request_), handle(handle_)
+            {
+            }
+
+            virtual ~OffloadTask()
+            {
+                // Dropped without running, the response will never come
+                if (handle != NULL) {
+                    handle->complete(NULL);
+                }
+                delete request;
+            }
+
+            void run()
+            {
+                Response *response = handler->process(*request);
+                ResponseHandle *completed = handle;
+
+                handle = NULL;
+                completed->complete(response);
+            }
+
+        protected:
+            RequestHandlerBase *handler;
+            Request *request;
+            ResponseHandle *handle;
+    };
+
     Controller::Controller() 
-        : sessions(NULL), server(NULL), prefix("")
+        : sessions(NULL), server(NULL), prefix(""), offloadRoutes(true)
     {
     }
 
@@ -18,6 +54,20 @@ namespace Mongoose
     void Controller::setServer(Server *server_)
     {
         server = server_;
+
+        // The routes registered before, from the constructor for instance
+        if (server != NULL) {
+            map<string, RequestHandlerBase *>::iterator it;
+            for (it=routes.begin(); it!=routes.end(); it++) {
+                size_t separator = (*it).first.find(':');
+                addToRouter((*it).first.substr(0, separator), (*it).first.substr(separator + 1), (*it).second);
+            }
+        }
+    }
+
+    Server *Controller::getServer()
+    {
+        return server;
     }
 
     void Controller::webSocketReady(WebSocket *websocket)
@@ -27,6 +77,11 @@ namespace Mongoose
     void Controller::webSocketData(WebSocket *websocket, string data)
     {
     }
+
+    void Controller::webSocketData(WebSocket *websocket, const struct mg_str &data, int)
+    {
+        webSocketData(websocket, string(data.p, data.len));
+    }
     
     Controller::~Controller()
     {
@@ -48,25 +103,65 @@ namespace Mongoose
 
     Response *Controller::process(Request &request)
     {
-        Response *response = NULL;
+        // The route the server found for this request
+        RequestHandlerBase *handler = request._getRoute(this);
+
+        if (handler == NULL && server != NULL) {
+            Router::Match match;
+            if (server->getRouter().find(request, match) && match.controller == this) {
+                handler = match.handler;
+            }
+        } else if (handler == NULL) {
+            string key = request.getMethod() + ":" + request.getUrl();
+            map<string, RequestHandlerBase *>::iterator it = routes.find(key);
+            if (it != routes.end()) {
+                handler = (*it).second;
+            }
+        }
 
-#ifdef ENABLE_REGEX_URL
-        map<string, RequestHandlerBase *>::iterator it; 
-        for (it=routes.begin(); it!=routes.end(); it++) {
-            if (request.match(it->first)){
-              response = it->second->process(request);
-              break;
-            }   
-        }   
-#else
-        string key = request.getMethod() + ":" + request.getUrl();
-        if (routes.find(key) != routes.end()) {
-            response = routes[key]->process(request);
+        if (handler == NULL) {
+            return NULL;
+        }
+
+        return dispatch(request, handler);
+    }
+
+    Response *Controller::dispatch(Request &request, RequestHandlerBase *handler)
+    {
+        bool offloaded = (handler->dispatch == RequestHandlerBase::DISPATCH_DEFAULT) ?
+            offloadRoutes : (handler->dispatch == RequestHandlerBase::DISPATCH_WORKER);
+        if (offloaded && server != NULL && server->getExecutor() != NULL) {
+            return offload(request, handler);
         }
-#endif
         
+        return handler->process(request);
+    }
+
+    Response *Controller::offload(Request &request, RequestHandlerBase *handler)
+    {
+        // The handler creates the response on the worker
+        ResponseHandle *handle = new ResponseHandle(server, NULL);
+        AsyncResponse *response = new AsyncResponse(handle);
+
+        server->getExecutor()->submit(new OffloadTask(handler, request.detach(), handle));
+
         return response;
     }
+
+    void Controller::setOffload(bool offload)
+    {
+        offloadRoutes = offload;
+    }
+
+    void Controller::setRouteOffload(string httpMethod, string route, bool offload)
+    {
+        map<string, RequestHandlerBase *>::iterator it = routes.find(httpMethod + ":" + prefix + route);
+
+        if (it != routes.end()) {
+            (*it).second->dispatch = offload ?
+                RequestHandlerBase::DISPATCH_WORKER : RequestHandlerBase::DISPATCH_INLINE;
+        }
+    }
             
     void Controller::preProcess(Request &request, Response &response)
     {
@@ -94,9 +189,29 @@ namespace Mongoose
             
     void Controller::registerRoute(string httpMethod, string route, RequestHandlerBase *handler)
     {
+#ifndef ENABLE_REGEX_URL
+        if (Router::countParameters(prefix + route) > MAX_ROUTE_PARAMETERS) {
+            delete handler;
+            throw mongoose_exception("Too many parameters in the route " + prefix + route);
+        }
+#endif
+
         string key = httpMethod + ":" + prefix + route;
         routes[key] = handler;
         urls.push_back(prefix + route);
+
+        if (server != NULL) {
+            addToRouter(httpMethod, prefix + route, handler);
+        }
+    }
+
+    void Controller::addToRouter(const string &httpMethod, const string &path, RequestHandlerBase *handler)
+    {
+#ifdef ENABLE_REGEX_URL
+        server->getRouter().addPattern(httpMethod, path, this, handler);
+#else
+        server->getRouter().add(httpMethod, path, this, handler);
+#endif
     }
 
     void Controller::dumpRoutes()
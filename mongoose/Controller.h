@@ -17,6 +17,12 @@ using namespace std;
 #define addRouteResponse(httpMethod, url, controllerType, method, responseType) \
     registerRoute(httpMethod, url, new RequestHandler<controllerType, responseType>(this, &controllerType::method ));
 
+#define addAsyncRoute(httpMethod, url, controllerType, method) \
+    registerRoute(httpMethod, url, new AsyncRequestHandler<controllerType, StreamResponse>(this, &controllerType::method ));
+
+#define addAsyncRouteResponse(httpMethod, url, controllerType, method, responseType) \
+    registerRoute(httpMethod, url, new AsyncRequestHandler<controllerType, responseType>(this, &controllerType::method ));
+
 /**
  * A controller is a module that respond to requests
  * 
@@ -34,12 +40,20 @@ namespace Mongoose
             virtual ~Controller();
 
             /**
-             * Sets the reference to the server hosting this controller
+             * Sets the reference to the server hosting this controller, the
+             * routes registered before are added to its router
              *
              * @param Server the hosting server
              */
             virtual void setServer(Server *server);
 
+            /**
+             * Gets the server hosting this controller
+             *
+             * @return Server* the hosting server
+             */
+            Server *getServer();
+
             /**
              * Called before a request is processed
              *
@@ -49,7 +63,8 @@ namespace Mongoose
             virtual void preProcess(Request &request, Response &response);
 
             /**
-             * Called to process a request
+             * Called to process a request, the server calls it with the
+             * requests matching a route of this controller
              *
              * @param Request the request
              *
@@ -58,6 +73,17 @@ namespace Mongoose
              */
             virtual Response *process(Request &request);
             
+            /**
+             * Runs the handler of a route matching the request, on the poll
+             * thread or on the server workers
+             *
+             * @param Request the request
+             * @param RequestHandlerBase the handler of the route
+             *
+             * @return Response the created response
+             */
+            Response *dispatch(Request &request, RequestHandlerBase *handler);
+
             /**
              * Called after a request is processed, if the controller responded
              *
@@ -95,18 +121,54 @@ namespace Mongoose
              * Called when data arrive in a websocket connection
              *
              * @param WebSocket the instance of the connection 
-             * @param string the data arriving
+             * @param string the data arriving, a whole message, or a fragment
+             *        of it when the websocket streams its messages
              */
             virtual void webSocketData(WebSocket *websocket, string data);
 
             /**
-             * Registers a route to the controller
+             * Called when data arrive in a websocket connection, without
+             * copying them. By default, this gives a copy to the other
+             * webSocketData()
+             *
+             * @param WebSocket the instance of the connection
+             * @param mg_str the data arriving, valid only during the call
+             * @param int the opcode of the message
+             */
+            virtual void webSocketData(WebSocket *websocket, const struct mg_str &data, int opcode);
+
+            /**
+             * Registers a route to the controller, the path can contain
+             * parameters like /users/:id, see Request::getParameter(). With
+             * ENABLE_REGEX_URL the path is a regex, see Request::getMatch().
+             * A path with more than MAX_ROUTE_PARAMETERS parameters is
+             * refused with a mongoose_exception
              *
              * @param string the route path
              * @param RequestHandlerBase the request handler for this route
              */
             virtual void registerRoute(string httpMethod, string route, RequestHandlerBase *handler);
 
+            /**
+             * Sets whether the routes of this controller are run by the
+             * server workers, see Server::setWorkers(). This is the default
+             *
+             * @param bool true to run the routes on the workers, false to run
+             *        them on the poll thread
+             */
+            void setOffload(bool offload);
+
+            /**
+             * Sets whether a registered route is run by the server workers,
+             * overriding the controller setting
+             *
+             * @param string the HTTP method of the route
+             * @param string the route path, without the prefix
+             * @param bool true to run the route on the workers, false to run
+             *        it on the poll thread
+             */
+            void setRouteOffload(string httpMethod, string route, bool offload);
+
             /**
              * Initializes the route and settings
              */
@@ -147,9 +209,29 @@ namespace Mongoose
             vector<string> getUrls();
 
         protected:
+            /**
+             * Runs the handler of a request on the server workers
+             *
+             * @param Request the request
+             * @param RequestHandlerBase the handler of the route
+             *
+             * @return Response the response, completed by the worker
+             */
+            Response *offload(Request &request, RequestHandlerBase *handler);
+
+            /**
+             * Adds a route to the router of the server
+             *
+             * @param string the HTTP method
+             * @param string the route path, with the prefix
+             * @param RequestHandlerBase the handler of the route
+             */
+            void addToRouter(const string &httpMethod, const string &path, RequestHandlerBase *handler);
+
             Sessions *sessions;
             Server *server;
             string prefix;
+            bool offloadRoutes;
             map<string, RequestHandlerBase*> routes;
             vector<string> urls;
     };
@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "CookieSessions.h"
+
+using namespace std;
+
+/**
+ * Url-encodes a value, so that the separators of the payload can't appear in it
+ */
+static void encode(string &out, const string &value)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    for (size_t i = 0; i < value.size(); i++) {
+        unsigned char c = value[i];
+
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                (c >= '0' && c <= '9') || c == '-' || c == '.' || c == '_' || c == '~') {
+            out += c;
+        } else {
+            out += '%';
+            out += hex[c >> 4];
+            out += hex[c & 15];
+        }
+    }
+}
+
+static string decode(const char *data, size_t size)
+{
+    vector<char> buffer(size + 1);
+    int length = mg_url_decode(data, size, &buffer[0], buffer.size(), 0);
+
+    return length < 0 ? string() : string(&buffer[0], length);
+}
+
+namespace Mongoose
+{
+    CookieSession::CookieSession(CookieSessions *sessions_, Response *response_)
+        : sessions(sessions_), response(response_), issued(0), stored(NULL)
+    {
+    }
+
+    Session::Snapshot CookieSession::getSnapshot()
+    {
+        if (stored != NULL) {
+            return stored->getSnapshot();
+        }
+
+        return Session::getSnapshot();
+    }
+
+    void CookieSession::apply(const Update &update)
+    {
+        if (stored != NULL) {
+            stored->apply(update);
+        } else {
+            Session::apply(update);
+            sessions->_save(*this);
+        }
+    }
+
+    void CookieSession::ping()
+    {
+        Session::ping();
+        if (stored != NULL) {
+            stored->ping();
+        }
+
+        // The client has a cookie about to expire, it gets a new one
+        if (issued != 0 && date - issued >= COOKIE_SESSIONS_REFRESH) {
+            sessions->_save(*this);
+        }
+    }
+
+    CookieSessions::CookieSessions(string secret_, string key_, int maxAge_)
+        : Sessions(key_), secret(secret_), maxAge(maxAge_)
+    {
+    }
+
+    string CookieSessions::getId(Request &request, Response &response)
+    {
+        CookieSession &session = static_cast<CookieSession &>(get(request, response));
+
+        return session.storedId;
+    }
+
+    Session &CookieSessions::get(Request &request, Response &response)
+    {
+        Session *attached = response._getSession();
+
+        if (attached != NULL) {
+            return *attached;
+        }
+
+        CookieSession *session = new CookieSession(this, &response);
+        response._setSession(session);
+
+        struct mg_str cookie;
+        if (request.getCookie(key, cookie) && cookie.len > 0) {
+            load(*session, cookie.p, cookie.len);
+        }
+
+        return *session;
+    }
+
+    void CookieSessions::sign(const string &payload, unsigned char mac[20])
+    {
+        cs_hmac_sha1((const unsigned char *) secret.data(), secret.size(),
+                (const unsigned char *) payload.data(), payload.size(), mac);
+    }
+
+    void CookieSessions::load(CookieSession &session, const char *cookie, size_t size)
+    {
+        const char *dot = (const char *) memchr(cookie, '.', size);
+
+        if (dot == NULL || size > COOKIE_SESSIONS_MAX_SIZE) {
+            return;
+        }
+
+        // The payload and the signature, both in base64
+        int payloadSize = dot - cookie;
+        int macSize = size - payloadSize - 1;
+        char payload[COOKIE_SESSIONS_MAX_SIZE];
+        char mac[32];
+        int length, macLength;
+
+        if (macSize != 28 ||
+                cs_base64_decode((const unsigned char *) cookie, payloadSize, payload, &length) != payloadSize ||
+                cs_base64_decode((const unsigned char *) dot + 1, macSize, mac, &macLength) != macSize ||
+                macLength != 20) {
+            return;
+        }
+
+        unsigned char expected[20];
+        unsigned char difference = 0;
+        sign(string(payload, length), expected);
+        for (int i = 0; i < 20; i++) {
+            difference |= expected[i] ^ (unsigned char) mac[i];
+        }
+        if (difference != 0) {
+            return;
+        }
+
+        // kind:issued:data
+        if (length < 3 || payload[1] != ':') {
+            return;
+        }
+        char *end;
+        time_t issued = strtol(payload + 2, &end, 10);
+        if (*end != ':' || time(NULL) - issued > maxAge) {
+            return;
+        }
+
+        const char *data = end + 1;
+        const char *dataEnd = payload + length;
+
+        if (payload[0] == 's') {
+            session.storedId.assign(data, dataEnd - data);
+            session.stored = lookup(data, dataEnd - data);
+        } else if (payload[0] == 'v') {
+            SessionValues *values = new SessionValues();
+
+            while (data < dataEnd) {
+                const char *next = (const char *) memchr(data, '&', dataEnd - data);
+                if (next == NULL) {
+                    next = dataEnd;
+                }
+
+                const char *equal = (const char *) memchr(data, '=', next - data);
+                if (equal != NULL) {
+                    values->values[decode(data, equal - data)] = decode(equal + 1, next - equal - 1);
+                }
+                data = next + 1;
+            }
+            session.swap(values);
+        } else {
+            return;
+        }
+
+        session.issued = issued;
+    }
+
+    void CookieSessions::_save(CookieSession &session)
+    {
+        time_t now = time(NULL);
+        char header[32];
+        string payload;
+
+        if (session.stored == NULL) {
+            snprintf(header, sizeof(header), "v:%ld:", (long) now);
+            payload = header;
+
+            Session::Snapshot snapshot = session.Session::getSnapshot();
+            const map<string, string> &values = snapshot.getValues();
+
+            map<string, string>::const_iterator it;
+            for (it=values.begin(); it!=values.end(); it++) {
+                if (it != values.begin()) {
+                    payload += '&';
+                }
+                encode(payload, it->first);
+                payload += '=';
+                encode(payload, it->second);
+            }
+
+            // Too large for a cookie, the values move to the server
+            if ((payload.size() + 2) / 3 * 4 + 29 > COOKIE_SESSIONS_MAX_SIZE) {
+                session.storedId = generateId();
+                session.stored = lookup(session.storedId.data(), session.storedId.size());
+
+                Session::Update update;
+                for (it=values.begin(); it!=values.end(); it++) {
+                    update.set(it->first, it->second);
+                }
+                session.stored->apply(update);
+                session.swap(new SessionValues());
+            }
+        }
+
+        if (session.stored != NULL) {
+            snprintf(header, sizeof(header), "s:%ld:", (long) now);
+            payload = header + session.storedId;
+        }
+
+        unsigned char mac[20];
+        sign(payload, mac);
+
+        vector<char> cookie((payload.size() + 2) / 3 * 4 + 30);
+        cs_base64_encode((const unsigned char *) payload.data(), payload.size(), &cookie[0]);
+        size_t length = strlen(&cookie[0]);
+        cookie[length] = '.';
+        cs_base64_encode(mac, sizeof(mac), &cookie[length + 1]);
+
+        session.response->setCookie(key, &cookie[0]);
+        session.issued = now;
+    }
+}
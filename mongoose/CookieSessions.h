@@ -0,0 +1,121 @@
+#ifndef _MONGOOSE_COOKIE_SESSIONS_H
+#define _MONGOOSE_COOKIE_SESSIONS_H
+
+#include <time.h>
+#include "Request.h"
+#include "Response.h"
+#include "Session.h"
+#include "Sessions.h"
+
+/**
+ * Maximum size of a session cookie, a session whose values do not fit
+ * is moved to the server and the cookie only references it
+ */
+#define COOKIE_SESSIONS_MAX_SIZE 2048
+
+/**
+ * A cookie older than this, in seconds, is issued again when its session
+ * is pinged, so that active sessions do not expire
+ */
+#define COOKIE_SESSIONS_REFRESH 60
+
+using namespace std;
+
+/**
+ * Sessions kept in the client cookies
+ *
+ * The values of the session are written in the cookie with their issue
+ * date and signed with HMAC-SHA1, each request verifies the signature
+ * instead of looking the session up, so there is no shared state nor lock.
+ * The values are signed but not encrypted: they can be read by the client
+ * and should not contain secrets.
+ *
+ * The sessions too large for a cookie fall back to the server store
+ */
+namespace Mongoose
+{
+    class CookieSessions;
+
+    /**
+     * The session of one request, it lives as long as the response, and
+     * writes the cookie again in the response each time it is modified
+     */
+    class CookieSession : public Session
+    {
+        public:
+            CookieSession(CookieSessions *sessions, Response *response);
+
+            virtual Snapshot getSnapshot();
+            virtual void apply(const Update &update);
+            virtual void ping();
+
+        protected:
+            friend class CookieSessions;
+
+            CookieSessions *sessions;
+            Response *response;
+
+            // Issue date of the cookie, 0 if the client has none
+            time_t issued;
+
+            // The session on the server, if the values did not fit
+            Session *stored;
+            string storedId;
+    };
+
+    class CookieSessions : public Sessions
+    {
+        public:
+            /**
+             * Creates cookie sessions
+             *
+             * @param string the secret key signing the cookies
+             * @param string the name of the cookie
+             * @param int the lifetime of a cookie without activity, in seconds
+             */
+            CookieSessions(string secret, string key = "sessid", int maxAge = 3600);
+
+            /**
+             * Gets the id of the server session holding the values of a
+             * request, the sessions fitting in cookies have no id
+             *
+             * @param Request the request
+             * @param Response the response
+             *
+             * @return string the session ID, empty if the values are in the cookie
+             */
+            virtual string getId(Request &request, Response &response);
+
+            /**
+             * Gets the session of a request, verifying its cookie
+             *
+             * @param Request the request
+             * @param Response the response, which owns the session
+             *
+             * @return Session the session, empty if the cookie is missing,
+             *         expired or not properly signed
+             */
+            virtual Session &get(Request &request, Response &response);
+
+            /**
+             * Writes the session in the cookie of its response
+             *
+             * @param CookieSession the session
+             */
+            void _save(CookieSession &session);
+
+        protected:
+            /**
+             * Loads a session from the cookie value, nothing is loaded if
+             * the signature or the date is not valid
+             */
+            void load(CookieSession &session, const char *cookie, size_t size);
+
+            void sign(const string &payload, unsigned char mac[20]);
+
+            string secret;
+            int maxAge;
+    };
+}
+
+#endif
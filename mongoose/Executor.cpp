@@ -0,0 +1,189 @@
+#include <mongoose.h>
+#include "Executor.h"
+
+using namespace std;
+using namespace Mongoose;
+
+static void *executor_work(void *param)
+{
+    Executor::Worker *worker = (Executor::Worker *)param;
+    worker->executor->_work(worker);
+
+    return NULL;
+}
+
+namespace Mongoose
+{
+    Executor::Executor(int count)
+        : next(0), stopping(false), started(false)
+    {
+        if (count < 1) {
+            count = 1;
+        }
+
+        for (int i = 0; i < count; i++) {
+            Worker *worker = new Worker;
+            worker->executor = this;
+            worker->index = i;
+            workers.push_back(worker);
+        }
+    }
+
+    Executor::~Executor()
+    {
+        stop();
+
+        vector<Worker *>::iterator it;
+        for (it = workers.begin(); it != workers.end(); it++) {
+            delete (*it);
+        }
+    }
+
+    void Executor::start()
+    {
+        if (started) {
+            return;
+        }
+        started = true;
+        stopping = false;
+
+        vector<Worker *>::iterator it;
+        for (it = workers.begin(); it != workers.end(); it++) {
+            mg_start_thread(executor_work, *it);
+        }
+    }
+
+    void Executor::stop()
+    {
+        if (!started) {
+            return;
+        }
+        stopping = true;
+
+        // Wakes every worker up, they exit instead of taking a task
+        for (size_t i = 0; i < workers.size(); i++) {
+            available.post();
+        }
+        for (size_t i = 0; i < workers.size(); i++) {
+            exited.wait();
+        }
+        started = false;
+
+        // The tokens of the tasks that did not run are dropped with them
+        vector<Worker *>::iterator it;
+        for (it = workers.begin(); it != workers.end(); it++) {
+            Worker *worker = *it;
+            deque<ExecutorTask *>::iterator tit;
+
+            worker->mutex.lock();
+            for (tit = worker->tasks.begin(); tit != worker->tasks.end(); tit++) {
+                delete (*tit);
+                available.wait();
+            }
+            worker->tasks.clear();
+            worker->mutex.unlock();
+        }
+    }
+
+    int Executor::getWorkers()
+    {
+        return workers.size();
+    }
+
+    void Executor::submit(ExecutorTask *task)
+    {
+        submitMutex.lock();
+        Worker *worker = workers[next];
+        next = (next + 1) % workers.size();
+        submitMutex.unlock();
+
+        worker->mutex.lock();
+        worker->tasks.push_back(task);
+        worker->mutex.unlock();
+
+        available.post();
+    }
+
+    ExecutorTask *Executor::pop(Worker *worker, bool oldest)
+    {
+        ExecutorTask *task = NULL;
+
+        if (!worker->tasks.empty()) {
+            if (oldest) {
+                task = worker->tasks.front();
+                worker->tasks.pop_front();
+            } else {
+                task = worker->tasks.back();
+                worker->tasks.pop_back();
+            }
+        }
+
+        return task;
+    }
+
+    ExecutorTask *Executor::take(Worker *worker)
+    {
+        // Oldest task of our own deque first
+        worker->mutex.lock();
+        ExecutorTask *task = pop(worker, true);
+        worker->mutex.unlock();
+
+        // Then the newest task of the others
+        for (size_t i = 1; task == NULL && i < workers.size(); i++) {
+            Worker *victim = workers[(worker->index + i) % workers.size()];
+
+            victim->mutex.lock();
+            task = pop(victim, false);
+            victim->mutex.unlock();
+        }
+
+        return task;
+    }
+
+    ExecutorTask *Executor::takeLocked(Worker *worker)
+    {
+        ExecutorTask *task = NULL;
+
+        // Always locked in the same order, take() holds one mutex at a time
+        vector<Worker *>::iterator it;
+        for (it = workers.begin(); it != workers.end(); it++) {
+            (*it)->mutex.lock();
+        }
+
+        task = pop(worker, true);
+        for (size_t i = 1; task == NULL && i < workers.size(); i++) {
+            task = pop(workers[(worker->index + i) % workers.size()], false);
+        }
+
+        for (it = workers.begin(); it != workers.end(); it++) {
+            (*it)->mutex.unlock();
+        }
+
+        return task;
+    }
+
+    void Executor::_work(Worker *worker)
+    {
+        while (true) {
+            available.wait();
+
+            // Having a token, a task is queued somewhere: a task is pushed
+            // before its token is posted, and there are never more workers
+            // holding a token than tasks queued. It can only be missed when
+            // a task is pushed behind us while another worker takes ours,
+            // looking again with everything locked always finds one
+            ExecutorTask *task = NULL;
+            if (!stopping && (task = take(worker)) == NULL) {
+                task = takeLocked(worker);
+            }
+
+            if (task == NULL) {
+                break;
+            }
+            task->run();
+            delete task;
+        }
+
+        exited.post();
+    }
+}
@@ -0,0 +1,133 @@
+#ifndef _MONGOOSE_EXECUTOR_H
+#define _MONGOOSE_EXECUTOR_H
+
+#include <deque>
+#include <vector>
+#include "Mutex.h"
+
+using namespace std;
+
+/**
+ * A pool of worker threads running tasks off the poll thread
+ *
+ * Each worker has its own deque: submitted tasks are spread over the
+ * workers, a worker takes the oldest task of its own deque, so that the
+ * requests are served in the order they came, and steals the newest one
+ * of another worker when its deque is empty
+ */
+namespace Mongoose
+{
+    class ExecutorTask
+    {
+        public:
+            /**
+             * Called with tasks that were never run when the executor is
+             * stopped, the task must release what it holds
+             */
+            virtual ~ExecutorTask() {}
+
+            /**
+             * Runs the task, this is called on a worker thread
+             */
+            virtual void run()=0;
+    };
+
+    class Executor
+    {
+        public:
+            /**
+             * Creates the executor
+             *
+             * @param int the number of worker threads
+             */
+            Executor(int workers);
+            virtual ~Executor();
+
+            /**
+             * Starts the worker threads
+             */
+            void start();
+
+            /**
+             * Waits for the running tasks and stops the worker threads, the
+             * tasks that did not start are deleted
+             */
+            void stop();
+
+            /**
+             * Queues a task, this can be called from any thread. The executor
+             * takes the ownership of the task
+             *
+             * @param ExecutorTask* the task to run
+             */
+            void submit(ExecutorTask *task);
+
+            /**
+             * Gets the number of worker threads
+             *
+             * @return int the number of workers
+             */
+            int getWorkers();
+
+            /**
+             * A worker thread and its tasks
+             */
+            struct Worker
+            {
+                Executor *executor;
+                int index;
+                Mutex mutex;
+                deque<ExecutorTask *> tasks;
+            };
+
+            /**
+             * Internally used as the main loop of the worker threads
+             *
+             * @param Worker* the worker
+             */
+            void _work(Worker *worker);
+
+        protected:
+            /**
+             * Takes a task from the deque of the given worker, or steals one
+             * from the other workers
+             *
+             * @param Worker* the worker
+             *
+             * @return ExecutorTask* the task, or NULL if all deques are empty
+             */
+            ExecutorTask *take(Worker *worker);
+
+            /**
+             * Takes a task like take(), with all the deques locked at once
+             * so that a task queued while they are looked at is not missed
+             *
+             * @param Worker* the worker
+             *
+             * @return ExecutorTask* the task, or NULL if all deques are empty
+             */
+            ExecutorTask *takeLocked(Worker *worker);
+
+            /**
+             * Pops a task of a deque, the mutex of the worker must be held
+             *
+             * @param Worker* the worker whose deque is popped
+             * @param bool true for the oldest task, false for the newest
+             *
+             * @return ExecutorTask* the task, or NULL if the deque is empty
+             */
+            static ExecutorTask *pop(Worker *worker, bool oldest);
+
+            vector<Worker *> workers;
+            Mutex submitMutex;
+            unsigned int next;
+            volatile bool stopping;
+            bool started;
+
+            // One token per queued task, plus one per worker when stopping
+            Semaphore available;
+            Semaphore exited;
+    };
+}
+
+#endif
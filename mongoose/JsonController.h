@@ -17,8 +17,10 @@ namespace Mongoose
     {
         public:
             /**
-             * Creates a json controller, each gcDivisor request, the sessions will be
-             * garbage collected
+             * Creates a json controller
+             *
+             * @param int unused, the sessions are now garbage collected by
+             *        the server every second
              */
             JsonController(int gcDivisor = 100);
 
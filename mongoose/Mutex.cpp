@@ -1,4 +1,5 @@
 #include <string>
+#include <limits.h>
 #include <iostream>
 
 #include "Mutex.h"
@@ -46,4 +47,137 @@ namespace Mongoose
     {
         pthread_mutex_unlock(&_mutex);
     }
+
+    AtomicCounter::AtomicCounter(long value)
+        : _value(value)
+    {
+    }
+
+#ifndef _MSC_VER
+    long AtomicCounter::increment()
+    {
+        return __sync_add_and_fetch(&_value, 1);
+    }
+
+    long AtomicCounter::decrement()
+    {
+        return __sync_sub_and_fetch(&_value, 1);
+    }
+
+    long AtomicCounter::get()
+    {
+        return __sync_add_and_fetch(&_value, 0);
+    }
+#else
+    long AtomicCounter::increment()
+    {
+        return InterlockedIncrement(&_value);
+    }
+
+    long AtomicCounter::decrement()
+    {
+        return InterlockedDecrement(&_value);
+    }
+
+    long AtomicCounter::get()
+    {
+        return InterlockedCompareExchange(&_value, 0, 0);
+    }
+#endif
+
+    AtomicPointer::AtomicPointer(void *value)
+        : _value(value)
+    {
+    }
+
+#ifndef _MSC_VER
+    bool AtomicPointer::compareAndSwap(void *expected, void *value)
+    {
+        return __sync_bool_compare_and_swap(&_value, expected, value);
+    }
+
+    void *AtomicPointer::exchange(void *value)
+    {
+        void *previous;
+
+        do {
+            previous = get();
+        } while (!__sync_bool_compare_and_swap(&_value, previous, value));
+
+        return previous;
+    }
+
+    void *AtomicPointer::get()
+    {
+        return __sync_val_compare_and_swap(&_value, (void *) 0, (void *) 0);
+    }
+#else
+    bool AtomicPointer::compareAndSwap(void *expected, void *value)
+    {
+        return InterlockedCompareExchangePointer(&_value, value, expected) == expected;
+    }
+
+    void *AtomicPointer::exchange(void *value)
+    {
+        return InterlockedExchangePointer(&_value, value);
+    }
+
+    void *AtomicPointer::get()
+    {
+        return InterlockedCompareExchangePointer(&_value, NULL, NULL);
+    }
+#endif
+
+#ifndef _MSC_VER
+    Semaphore::Semaphore()
+        : _count(0)
+    {
+        pthread_mutex_init(&_mutex, NULL);
+        pthread_cond_init(&_condition, NULL);
+    }
+
+    Semaphore::~Semaphore()
+    {
+        pthread_cond_destroy(&_condition);
+        pthread_mutex_destroy(&_mutex);
+    }
+
+    void Semaphore::wait()
+    {
+        pthread_mutex_lock(&_mutex);
+        while (_count == 0) {
+            pthread_cond_wait(&_condition, &_mutex);
+        }
+        _count--;
+        pthread_mutex_unlock(&_mutex);
+    }
+
+    void Semaphore::post()
+    {
+        pthread_mutex_lock(&_mutex);
+        _count++;
+        pthread_cond_signal(&_condition);
+        pthread_mutex_unlock(&_mutex);
+    }
+#else
+    Semaphore::Semaphore()
+    {
+        _semaphore = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+    }
+
+    Semaphore::~Semaphore()
+    {
+        CloseHandle(_semaphore);
+    }
+
+    void Semaphore::wait()
+    {
+        WaitForSingleObject(_semaphore, INFINITE);
+    }
+
+    void Semaphore::post()
+    {
+        ReleaseSemaphore(_semaphore, 1, NULL);
+    }
+#endif
 }
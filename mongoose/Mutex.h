@@ -32,6 +32,103 @@ namespace Mongoose
         protected:
             pthread_mutex_t _mutex;
     };
+
+    /**
+     * A counter changed atomically, used for reference counts
+     */
+    class AtomicCounter
+    {
+        public:
+            AtomicCounter(long value = 0);
+
+            /**
+             * Increments the counter
+             *
+             * @return long the new value
+             */
+            long increment();
+
+            /**
+             * Decrements the counter
+             *
+             * @return long the new value
+             */
+            long decrement();
+
+            /**
+             * Gets the counter
+             */
+            long get();
+
+        protected:
+            volatile long _value;
+    };
+
+    /**
+     * A pointer changed atomically, used for lock-free lists
+     */
+    class AtomicPointer
+    {
+        public:
+            AtomicPointer(void *value = 0);
+
+            /**
+             * Sets the pointer if it still has the expected value
+             *
+             * @param void* the expected value
+             * @param void* the new value
+             *
+             * @return bool true if the pointer was set
+             */
+            bool compareAndSwap(void *expected, void *value);
+
+            /**
+             * Sets the pointer
+             *
+             * @param void* the new value
+             *
+             * @return void* the previous value
+             */
+            void *exchange(void *value);
+
+            /**
+             * Gets the pointer
+             */
+            void *get();
+
+        protected:
+            void * volatile _value;
+    };
+
+    /**
+     * A counting semaphore, used to put threads to sleep until there is
+     * something for them to do
+     */
+    class Semaphore
+    {
+        public:
+            Semaphore();
+            virtual ~Semaphore();
+
+            /**
+             * Waits until the count is positive, then decrements it
+             */
+            virtual void wait();
+
+            /**
+             * Increments the count, waking up one waiting thread
+             */
+            virtual void post();
+
+        protected:
+#ifndef _MSC_VER
+            pthread_mutex_t _mutex;
+            pthread_cond_t _condition;
+            unsigned int _count;
+#else
+            HANDLE _semaphore;
+#endif
+    };
 }
 
 #endif
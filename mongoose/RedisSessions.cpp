@@ -0,0 +1,362 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "RedisSessions.h"
+#include "Server.h"
+
+using namespace std;
+using namespace Mongoose;
+
+static void redis_handler(struct mg_connection *connection, int ev, void *ev_data)
+{
+    RedisSessions *sessions = (RedisSessions *) connection->user_data;
+
+    if (sessions == NULL) {
+        return;
+    }
+
+    if (ev == MG_EV_CONNECT) {
+        if (*(int *) ev_data != 0) {
+            connection->flags |= MG_F_CLOSE_IMMEDIATELY;
+        }
+    } else if (ev == MG_EV_RECV) {
+        sessions->_receive(connection);
+    } else if (ev == MG_EV_CLOSE) {
+        sessions->_close(connection);
+    }
+}
+
+/**
+ * Parses one RESP reply, the bulk strings it contains are appended to
+ * values, and error is set if it is or contains an error
+ *
+ * @return int the size of the reply, 0 if it is not complete, -1 if it is invalid
+ */
+static int parseReply(const char *data, int size, vector<string> &values, bool &error)
+{
+    const char *end = (const char *) memchr(data, '\n', size);
+
+    if (end == NULL) {
+        return 0;
+    }
+    if (end == data || end[-1] != '\r') {
+        return -1;
+    }
+
+    int lineSize = end - data + 1;
+    long number = strtol(data + 1, NULL, 10);
+
+    switch (data[0]) {
+        case '-':
+            error = true;
+            return lineSize;
+        case '+':
+        case ':':
+            return lineSize;
+        case '$':
+            if (number < 0) {
+                return lineSize;
+            }
+            if (size - lineSize < number + 2) {
+                return 0;
+            }
+            values.push_back(string(data + lineSize, number));
+            return lineSize + number + 2;
+        case '*': {
+            int offset = lineSize;
+
+            for (long i = 0; i < number; i++) {
+                int elementSize = parseReply(data + offset, size - offset, values, error);
+
+                if (elementSize <= 0) {
+                    return elementSize;
+                }
+                offset += elementSize;
+            }
+            return offset;
+        }
+    }
+
+    return -1;
+}
+
+namespace Mongoose
+{
+    /**
+     * Sends a command from the poll thread
+     */
+    class RedisWriteTask : public ServerTask
+    {
+        public:
+            RedisWriteTask(RedisSessions *sessions_, const string &command_, int replies_)
+                : sessions(sessions_), command(command_), replies(replies_)
+            {
+            }
+
+            void run(Server *)
+            {
+                sessions->_sendWrite(command, replies);
+            }
+
+        protected:
+            RedisSessions *sessions;
+            string command;
+            int replies;
+    };
+
+    RedisSession::RedisSession(RedisSessions *sessions_, const string &id_)
+        : sessions(sessions_), id(id_), written(0), fetched(0), refreshed(0)
+    {
+    }
+
+    void RedisSession::apply(const Update &update)
+    {
+        // All the changes are sent at once, followed by the expiration
+        string name = sessions->getHashName(id);
+        string command;
+
+        vector<Update::Change>::const_iterator it;
+        for (it=update.changes.begin(); it!=update.changes.end(); it++) {
+            if ((*it).unset) {
+                command += "*3\r\n";
+                RedisSessions::appendArgument(command, "HDEL");
+                RedisSessions::appendArgument(command, name);
+                RedisSessions::appendArgument(command, (*it).key);
+            } else {
+                command += "*4\r\n";
+                RedisSessions::appendArgument(command, "HSET");
+                RedisSessions::appendArgument(command, name);
+                RedisSessions::appendArgument(command, (*it).key);
+                RedisSessions::appendArgument(command, (*it).value);
+            }
+        }
+
+        char maxAge[16];
+        snprintf(maxAge, sizeof(maxAge), "%d", sessions->getMaxAge());
+        command += "*3\r\n";
+        RedisSessions::appendArgument(command, "EXPIRE");
+        RedisSessions::appendArgument(command, name);
+        RedisSessions::appendArgument(command, maxAge);
+
+        // Stamped with the values changed, a read of Redis in flight can't
+        // publish the values from before them
+        writeMutex.lock();
+        change(update);
+        written = sessions->_write(command, update.changes.size() + 1);
+        writeMutex.unlock();
+    }
+
+    void RedisSession::refresh(SessionValues *values_, unsigned long sent)
+    {
+        writeMutex.lock();
+        if (written <= sent) {
+            publish(values_);
+            fetched = time(NULL);
+        } else {
+            // Redis may not have the last write yet, the values are read
+            // again by the next request
+            values_->release();
+        }
+        writeMutex.unlock();
+    }
+
+    void RedisSession::ping()
+    {
+        Session::ping();
+
+        mutex.lock();
+        bool refresh = (date - refreshed >= REDIS_SESSIONS_REFRESH);
+        if (refresh) {
+            refreshed = date;
+        }
+        mutex.unlock();
+
+        if (refresh) {
+            char maxAge[16];
+            snprintf(maxAge, sizeof(maxAge), "%d", sessions->getMaxAge());
+
+            string command = "*3\r\n";
+            RedisSessions::appendArgument(command, "EXPIRE");
+            RedisSessions::appendArgument(command, sessions->getHashName(id));
+            RedisSessions::appendArgument(command, maxAge);
+
+            sessions->_write(command, 1);
+        }
+    }
+
+    RedisSessions::RedisSessions(Server *server_, string address_, string key_, int maxAge_)
+        : Sessions(key_), server(server_), address(address_), maxAge(maxAge_),
+        cacheTtl(REDIS_SESSIONS_CACHE_TTL), written(0), connection(NULL), sent(0)
+    {
+    }
+
+    void RedisSessions::setCacheTtl(int ttl)
+    {
+        cacheTtl = ttl;
+    }
+
+    int RedisSessions::getMaxAge()
+    {
+        return maxAge;
+    }
+
+    string RedisSessions::getHashName(const string &id)
+    {
+        return key + ":" + id;
+    }
+
+    void RedisSessions::appendArgument(string &command, const string &argument)
+    {
+        char header[24];
+
+        snprintf(header, sizeof(header), "$%u\r\n", (unsigned int) argument.size());
+        command += header;
+        command += argument;
+        command += "\r\n";
+    }
+
+    Session *RedisSessions::createSession(const char *id, size_t size)
+    {
+        return new RedisSession(this, string(id, size));
+    }
+
+    bool RedisSessions::_isLoaded(Request &request)
+    {
+        struct mg_str cookie;
+
+        // A new session has nothing to load
+        if (!request.getCookie(key, cookie) || cookie.len == 0) {
+            return true;
+        }
+
+        RedisSession *session = static_cast<RedisSession *>(lookup(cookie.p, cookie.len));
+
+        return time(NULL) - session->fetched < cacheTtl;
+    }
+
+    void RedisSessions::_load(Request &request, ServerTask *task)
+    {
+        struct mg_str cookie;
+
+        if (!request.getCookie(key, cookie) || cookie.len == 0) {
+            task->run(server);
+            delete task;
+            return;
+        }
+
+        string id(cookie.p, cookie.len);
+        string command = "*2\r\n";
+        appendArgument(command, "HGETALL");
+        appendArgument(command, getHashName(id));
+
+        if (!_send(command, 1, id, task)) {
+            delete task;
+        }
+    }
+
+    unsigned long RedisSessions::_write(const string &command, int replies)
+    {
+        writeMutex.lock();
+        unsigned long stamp = ++written;
+        server->post(new RedisWriteTask(this, command, replies));
+        writeMutex.unlock();
+
+        return stamp;
+    }
+
+    void RedisSessions::_sendWrite(const string &command, int replies)
+    {
+        _send(command, replies);
+        sent++;
+    }
+
+    bool RedisSessions::_send(const string &command, int replies, const string &id, ServerTask *task)
+    {
+        if (connection == NULL) {
+            connection = mg_connect(server->_getManager(), address.c_str(), redis_handler);
+
+            if (connection == NULL) {
+                return false;
+            }
+            connection->user_data = this;
+        }
+
+        // Sent once connected if it is not yet, the replies come in order
+        mg_send(connection, command.data(), command.size());
+
+        for (int i = 0; i < replies; i++) {
+            Pending entry;
+            entry.sent = sent;
+            if (i == replies - 1) {
+                entry.id = id;
+                entry.task = task;
+            } else {
+                entry.task = NULL;
+            }
+            pending.push_back(entry);
+        }
+
+        return true;
+    }
+
+    void RedisSessions::_receive(struct mg_connection *connection_)
+    {
+        struct mbuf *buffer = &connection_->recv_mbuf;
+
+        while (!pending.empty() && buffer->len > 0) {
+            vector<string> values;
+            bool error = false;
+            int size = parseReply(buffer->buf, buffer->len, values, error);
+
+            if (size == 0) {
+                break;
+            }
+            if (size < 0) {
+                connection_->flags |= MG_F_CLOSE_IMMEDIATELY;
+                break;
+            }
+            mbuf_remove(buffer, size);
+
+            Pending entry = pending.front();
+            pending.pop_front();
+
+            // An error is not an empty session, like when Redis is loading
+            // its data: the values cached are kept and the load fails
+            if (!entry.id.empty() && !error) {
+                RedisSession *session = static_cast<RedisSession *>(lookup(entry.id.data(), entry.id.size()));
+
+                SessionValues *fetched = new SessionValues();
+                for (size_t i = 0; i + 1 < values.size(); i += 2) {
+                    fetched->values[values[i]] = values[i + 1];
+                }
+                session->refresh(fetched, entry.sent);
+            }
+
+            if (entry.task != NULL) {
+                if (!error) {
+                    entry.task->run(server);
+                }
+                delete entry.task;
+            }
+        }
+    }
+
+    void RedisSessions::_close(struct mg_connection *connection_)
+    {
+        if (connection_ != connection) {
+            return;
+        }
+        connection = NULL;
+
+        // The loads waiting for a reply fail
+        deque<Pending> failed;
+        failed.swap(pending);
+
+        deque<Pending>::iterator it;
+        for (it=failed.begin(); it!=failed.end(); it++) {
+            if ((*it).task != NULL) {
+                delete (*it).task;
+            }
+        }
+    }
+}
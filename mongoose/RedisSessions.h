@@ -0,0 +1,202 @@
+#ifndef _MONGOOSE_REDIS_SESSIONS_H
+#define _MONGOOSE_REDIS_SESSIONS_H
+
+#include <time.h>
+#include <deque>
+#include <vector>
+#include <mongoose.h>
+#include "Mutex.h"
+#include "Request.h"
+#include "Session.h"
+#include "Sessions.h"
+
+/**
+ * Time during which a session read from Redis is used without asking
+ * Redis again, in seconds
+ */
+#define REDIS_SESSIONS_CACHE_TTL 5
+
+/**
+ * The expiration of a session in Redis is pushed back when it is pinged
+ * at least this long after the last time, in seconds
+ */
+#define REDIS_SESSIONS_REFRESH 60
+
+using namespace std;
+
+/**
+ * Sessions stored in Redis, or any server speaking its protocol, so that
+ * several servers behind a load balancer share them
+ *
+ * Each session is a Redis hash, named from the cookie name and the session
+ * id, expiring after maxAge seconds without activity. The server talks to
+ * Redis with a non-blocking mongoose connection on its poll thread, and
+ * the commands are pipelined on it.
+ *
+ * The sessions read are kept in a local cache. A request whose session
+ * was not read recently is put aside while it is loaded, and dispatched
+ * when Redis replies, so the poll thread never waits. The values set are
+ * written to the cache and sent to Redis without waiting for the reply.
+ *
+ * The sessions have to outlive the server, or the server to be stopped
+ * before they are destroyed
+ */
+namespace Mongoose
+{
+    class Server;
+    class RedisSessions;
+
+    class RedisSession : public Session
+    {
+        public:
+            RedisSession(RedisSessions *sessions, const string &id);
+
+            virtual void apply(const Update &update);
+            virtual void ping();
+
+        protected:
+            friend class RedisSessions;
+
+            /**
+             * Publishes the values read from Redis, unless they may predate
+             * a write of this server, this is called on the poll thread
+             *
+             * @param SessionValues* the values, the session takes the reference
+             * @param unsigned long the number of writes sent before the read
+             */
+            void refresh(SessionValues *values, unsigned long sent);
+
+            RedisSessions *sessions;
+            string id;
+
+            // Stamp of the last write of the values, under the write mutex
+            unsigned long written;
+
+            // Last time the values were read from Redis, used on the poll thread
+            time_t fetched;
+
+            // Last time the expiration was pushed back
+            time_t refreshed;
+    };
+
+    class RedisSessions : public Sessions
+    {
+        public:
+            /**
+             * Creates sessions stored in Redis
+             *
+             * @param Server* the server whose poll thread talks to Redis
+             * @param string the address of Redis, "host:port"
+             * @param string the name of the cookie
+             * @param int the lifetime of a session without activity, in seconds
+             */
+            RedisSessions(Server *server, string address = "127.0.0.1:6379",
+                    string key = "sessid", int maxAge = 3600);
+
+            /**
+             * Sets the time during which a session read is used from the
+             * local cache
+             *
+             * @param int the time, in seconds
+             */
+            void setCacheTtl(int ttl);
+
+            virtual bool _isLoaded(Request &request);
+            virtual void _load(Request &request, ServerTask *task);
+
+            /**
+             * Sends a command to Redis from any thread, without waiting
+             * for its replies
+             *
+             * @param string the command, RESP encoded
+             * @param int the number of replies it will get
+             *
+             * @return unsigned long the stamp of the write, the writes are
+             *         sent in the order of their stamps
+             */
+            unsigned long _write(const string &command, int replies);
+
+            /**
+             * Sends a command given to _write, this is called on the poll thread
+             *
+             * @param string the command, RESP encoded
+             * @param int the number of replies it will get
+             */
+            void _sendWrite(const string &command, int replies);
+
+            /**
+             * Sends a command to Redis, this is called on the poll thread
+             *
+             * @param string the command, RESP encoded
+             * @param int the number of replies it will get
+             * @param string the session whose values are in the last reply, empty if none
+             * @param ServerTask* the task to run after the last reply, or NULL
+             *
+             * @return bool false if Redis can't be reached
+             */
+            bool _send(const string &command, int replies, const string &id = "", ServerTask *task = NULL);
+
+            /**
+             * Internally used to handle the data received from Redis
+             *
+             * @param struct mg_connection* the connection to Redis
+             */
+            void _receive(struct mg_connection *connection);
+
+            /**
+             * Internally used when the connection to Redis is closed, the
+             * pending loads fail
+             *
+             * @param struct mg_connection* the connection to Redis
+             */
+            void _close(struct mg_connection *connection);
+
+            /**
+             * Encodes a command argument
+             *
+             * @param string the command to append to
+             * @param string the argument
+             */
+            static void appendArgument(string &command, const string &argument);
+
+            /**
+             * Gets the name of the Redis hash of a session
+             *
+             * @param string the session id
+             *
+             * @return string the name of the hash
+             */
+            string getHashName(const string &id);
+
+            int getMaxAge();
+
+        protected:
+            struct Pending
+            {
+                string id;
+                ServerTask *task;
+
+                // The number of writes sent before the command
+                unsigned long sent;
+            };
+
+            virtual Session *createSession(const char *id, size_t size);
+
+            Server *server;
+            string address;
+            int maxAge;
+            int cacheTtl;
+
+            // The writes are stamped and posted at once, so that they
+            // run in the order of their stamps
+            Mutex writeMutex;
+            unsigned long written;
+
+            // Used on the poll thread only
+            struct mg_connection *connection;
+            deque<Pending> pending;
+            unsigned long sent;
+    };
+}
+
+#endif
@@ -6,197 +6,289 @@
 
 using namespace std;
 
-static int lowercase(const char *s) {
-  return tolower(* (const unsigned char *) s);
-}
+namespace Mongoose
+{
+    Request::Request(struct mg_connection *connection_, struct http_message *message_) 
+		: arena(arenaStorage, sizeof(arenaStorage))
+		, variablesParsed(false)
+		, variablesData(ArenaAllocator<char>(&arena))
+		, variables(ArenaAllocator<Variable>(&arena))
+		, cookiesParsed(false)
+		, cookies(ArenaAllocator<Cookie>(&arena))
+		, parametersCount(0)
+		, routeController(NULL)
+		, routeHandler(NULL)
+		, connection(connection_)
+		, message(message_)
+		, ownedData(ArenaAllocator<char>(&arena))
+    {
+        if (connection != NULL) {
+            remoteAddress = connection->sa;
+        } else {
+            memset(&remoteAddress, 0, sizeof(remoteAddress));
+        }
+    }
 
-static int mg_strncasecmp(const char *s1, const char *s2, size_t len) {
-  int diff = 0;
+    const struct mg_str &Request::getUrlView()
+    {
+        return message->uri;
+    }
 
-  if (len > 0)
-    do {
-      diff = lowercase(s1++) - lowercase(s2++);
-    } while (diff == 0 && s1[-1] != '\0' && --len > 0);
+    const struct mg_str &Request::getMethodView()
+    {
+        return message->method;
+    }
 
-  return diff;
-}
+    const struct mg_str &Request::getDataView()
+    {
+        return message->body;
+    }
 
-static void mg_strlcpy(register char *dst, register const char *src, size_t n) {
-  for (; *src != '\0' && n > 1; n--) {
-    *dst++ = *src++;
-  }
-  *dst = '\0';
-}
+    string Request::getUrl()
+    {
+        return string(message->uri.p, message->uri.len);
+    }
 
-/*
-static int mg_strcasecmp(const char *s1, const char *s2) {
-  int diff;
+    string Request::getMethod()
+    {
+        return string(message->method.p, message->method.len);
+    }
 
-  do {
-    diff = lowercase(s1++) - lowercase(s2++);
-  } while (diff == 0 && s1[-1] != '\0');
+    string Request::getData()
+    {
+        return string(message->body.p, message->body.len);
+    }
 
-  return diff;
-}
-*/
+	string Request::getRemoteIp() {
+		return std::string(inet_ntoa(remoteAddress.sin.sin_addr));
+	}
 
-static const char *mg_strcasestr(const char *big_str, const char *small_str) {
-  int i, big_len = strlen(big_str), small_len = strlen(small_str);
+#ifdef ENABLE_REGEX_URL
+    void Request::_setMatches(const cmatch &matches)
+    {
+        // The groups are kept as unnamed parameters, without the whole url
+        parametersCount = 0;
+
+        for (size_t i = 1; i < matches.size() && parametersCount < MAX_ROUTE_PARAMETERS; i++) {
+            Parameter &parameter = parameters[parametersCount++];
+            parameter.name = NULL;
+            parameter.value.p = matches[i].matched ? matches[i].first : NULL;
+            parameter.value.len = matches[i].matched ? matches[i].length() : 0;
+        }
+    }
 
-  for (i = 0; i <= big_len - small_len; i++) {
-    if (mg_strncasecmp(big_str + i, small_str, small_len) == 0) {
-      return big_str + i;
+    int Request::getMatchCount()
+    {
+        return parametersCount + 1;
     }
-  }
 
-  return NULL;
-}
+    bool Request::getMatch(int index, struct mg_str &value)
+    {
+        if (index == 0) {
+            value = message->uri;
+            return true;
+        }
+        if (index < 0 || index > parametersCount || parameters[index-1].value.p == NULL) {
+            return false;
+        }
+        value = parameters[index-1].value;
 
-static int mg_get_cookie(const char *cookie_header, const char *var_name,
-                  char *dst, size_t dst_size) {
-  const char *s, *p, *end;
-  int name_len, len = -1;
-
-  if (dst == NULL || dst_size == 0) {
-    len = -2;
-  } else if (var_name == NULL || (s = cookie_header) == NULL) {
-    len = -1;
-    dst[0] = '\0';
-  } else {
-    name_len = (int) strlen(var_name);
-    end = s + strlen(s);
-    dst[0] = '\0';
-
-    for (; (s = mg_strcasestr(s, var_name)) != NULL; s += name_len) {
-      if (s[name_len] == '=') {
-        s += name_len + 1;
-        if ((p = strchr(s, ' ')) == NULL)
-          p = end;
-        if (p[-1] == ';')
-          p--;
-        if (*s == '"' && p[-1] == '"' && p > s + 1) {
-          s++;
-          p--;
+        return true;
+    }
+
+    string Request::getMatch(int index, string fallback)
+    {
+        struct mg_str value;
+
+        if (getMatch(index, value)) {
+            return string(value.p, value.len);
         }
-        if ((size_t) (p - s) < dst_size) {
-          len = p - s;
-          mg_strlcpy(dst, s, (size_t) len + 1);
-        } else {
-          len = -3;
+
+        return fallback;
+    }
+#endif
+
+    void Request::writeResponse(Response *response)
+    {
+        if (connection != NULL) {
+            response->write(connection);
         }
-        break;
-      }
     }
-  }
-  return len;
-}
 
-namespace Mongoose
-{
-    Request::Request(struct mg_connection *connection_, struct http_message *message_) 
-		: connection(connection_)
-		, message(message_)
+    struct http_message *Request::_getMessage()
     {
-        url = std::string(message->uri.p, message->uri.len);
-        method = std::string(message->method.p, message->method.len);
+        return message;
+    }
 
-        // Downloading POST data
-        ostringstream postData;
-        postData.write(message->body.p, message->body.len);
-        data = postData.str();
+    static void rebase(struct mg_str &str, const char *from, size_t len, const char *to)
+    {
+        if (str.p != NULL && str.p >= from && str.p <= from + len) {
+            str.p = to + (str.p - from);
+        }
     }
 
-    string Request::getUrl()
+    Request *Request::detach()
     {
-        return url;
+        Request *request = new Request(connection, message);
+        const char *begin = message->message.p;
+        const char *end = begin + message->message.len;
+
+        // The body is not always accounted in the message length
+        if (message->body.p != NULL && message->body.p + message->body.len > end) {
+            end = message->body.p + message->body.len;
+        }
+
+        request->ownedData.assign(begin, end);
+        request->ownedMessage = *message;
+        request->message = &request->ownedMessage;
+        request->connection = NULL;
+        request->remoteAddress = remoteAddress;
+        request->routeController = routeController;
+        request->routeHandler = routeHandler;
+
+        if (!request->ownedData.empty()) {
+            struct http_message *copy = &request->ownedMessage;
+            const char *to = &request->ownedData[0];
+            size_t len = end - begin;
+
+            rebase(copy->message, begin, len, to);
+            rebase(copy->method, begin, len, to);
+            rebase(copy->uri, begin, len, to);
+            rebase(copy->proto, begin, len, to);
+            rebase(copy->resp_status_msg, begin, len, to);
+            rebase(copy->query_string, begin, len, to);
+            rebase(copy->body, begin, len, to);
+            for (int i = 0; i < MG_MAX_HTTP_HEADERS; i++) {
+                rebase(copy->header_names[i], begin, len, to);
+                rebase(copy->header_values[i], begin, len, to);
+            }
+
+            request->parametersCount = parametersCount;
+            for (int i = 0; i < parametersCount; i++) {
+                request->parameters[i] = parameters[i];
+                rebase(request->parameters[i].value, begin, len, to);
+            }
+        }
+
+        return request;
     }
 
-    string Request::getMethod()
+    bool Request::hasVariable(string key)
     {
-        return method;
+        struct mg_str value;
+
+        return getVariable(key, value);
     }
 
-    string Request::getData()
+    /**
+     * Appends the url-decoded src to the buffer, the raw bytes are kept if
+     * src is not valid url-encoded data
+     */
+    static size_t append_decoded(vector<char, ArenaAllocator<char> > &buffer, size_t &used, const char *src, size_t len)
     {
-        return data;
+        size_t offset = used;
+        int decoded = mg_url_decode(src, len, &buffer[used], buffer.size() - used, 1);
+
+        if (decoded < 0) {
+            memcpy(&buffer[used], src, len);
+            decoded = len;
+        }
+        used += decoded;
+
+        return offset;
     }
 
-	string Request::getRemoteIp() {
-		return std::string(inet_ntoa(connection->sa.sin.sin_addr));
-	}
+    void Request::indexVariables(const struct mg_str &data)
+    {
+        const char *p = data.p, *end = data.p + data.len;
+        size_t used = 0;
 
-#ifdef ENABLE_REGEX_URL
-    smatch Request::getMatches()
-    {   
-        return matches;
-    }   
-
-    bool Request::match(string pattern)
-    {   
-        key = method + ":" + url;
-        return regex_match(key, matches, regex(pattern));
-    }   
-#endif
+        if (!variables.empty()) {
+            const Variable &last = variables.back();
+            used = last.value + last.valueLength;
+        }
 
-    void Request::writeResponse(Response *response)
+        // data is "var1=val1&var2=val2..."
+        while (p < end) {
+            const char *next = (const char *) memchr(p, '&', end - p);
+            if (next == NULL) {
+                next = end;
+            }
+            const char *eq = (const char *) memchr(p, '=', next - p);
+            const char *keyEnd = (eq == NULL) ? next : eq;
+
+            if (keyEnd > p) {
+                Variable variable;
+                variable.key = append_decoded(variablesData, used, p, keyEnd - p);
+                variable.keyLength = used - variable.key;
+                if (eq != NULL) {
+                    variable.value = append_decoded(variablesData, used, eq + 1, next - eq - 1);
+                } else {
+                    variable.value = used;
+                }
+                variable.valueLength = used - variable.value;
+                variables.push_back(variable);
+            }
+            p = next + 1;
+        }
+    }
+
+    void Request::parseVariables()
     {
-        string data = response->getData();
+        struct mg_str body = {NULL, 0};
+        struct mg_str *contentType = mg_get_http_header(message, "Content-Type");
+
+        variablesParsed = true;
 
-		mg_send(connection, data.c_str(), data.size());
+        if (contentType != NULL && contentType->len >= 33 &&
+                mg_ncasecmp(contentType->p, "application/x-www-form-urlencoded", 33) == 0) {
+            body = message->body;
+        }
+
+        size_t size = message->query_string.len + body.len;
+        if (size == 0) {
+            return;
+        }
+
+        // Decoded data is never longer than the source, plus one for the
+        // terminating zero mg_url_decode always writes
+        variablesData.resize(size + 1);
+        indexVariables(message->query_string);
+        indexVariables(body);
     }
 
-    bool Request::hasVariable(string key)
+    bool Request::getVariable(const string &key, struct mg_str &value)
     {
-		for (int i = 0 ; i < ARRAY_SIZE(message->header_names); i++) {
-			if (strcmp(message->header_names[i].p, key.c_str()) == 0) {
-				return true;
-			}
-		}
+        if (!variablesParsed) {
+            parseVariables();
+        }
+
+        vector<Variable, ArenaAllocator<Variable> >::iterator it;
+        for (it=variables.begin(); it!=variables.end(); it++) {
+            if ((*it).keyLength == key.size() &&
+                    mg_ncasecmp(&variablesData[(*it).key], key.c_str(), key.size()) == 0) {
+                value.p = &variablesData[(*it).value];
+                value.len = (*it).valueLength;
+                return true;
+            }
+        }
+
         return false;
     }
 
-	Request::arg_vector get_var_vector(const char *data, size_t data_len) {
+	Request::arg_vector Request::getVariablesVector() {
 		Request::arg_vector ret;
 
-		if (data == NULL || data_len == 0)
-			return ret;
-		
-		istringstream f(string(data, data_len));
-		string s;    
-		char *tmp = new char[data_len+1];
-		// data is "var1=val1&var2=val2...". Find variable first
-		while (getline(f, s, '&')) {
-			string::size_type eq_pos = s.find('=');
-			string key, val;
-			if (eq_pos != string::npos) {
-				key = s.substr(0, eq_pos);
-				val = s.substr(eq_pos+1);
-			} else {
-				key = s;
-			}
-			if (mg_url_decode(key.c_str(), key.length(), tmp, data_len+1, 1) == -1) {
-				delete [] tmp;
-				return ret;
-			}
-			key = tmp;
-			if (val.length() > 0) {
-				if (mg_url_decode(val.c_str(), val.length(), tmp, data_len+1, 1) == -1) {
-					delete [] tmp;
-					return ret;
-				}
-				val = tmp;
-			}
-			ret.push_back(Request::arg_entry(key, val));
+		if (!variablesParsed) {
+			parseVariables();
 		}
-		delete [] tmp;
-		return ret;
-	}
-
 
-	Request::arg_vector Request::getVariablesVector() {
-		return get_var_vector(message->query_string.p, message->query_string.p == NULL ? 0 : message->query_string.len);
-// 		if (len < 0)
-// 			len = get_var_vector(conn->content, conn->content_len);
+		vector<Variable, ArenaAllocator<Variable> >::iterator it;
+		for (it=variables.begin(); it!=variables.end(); it++) {
+			ret.push_back(Request::arg_entry(string(&variablesData[(*it).key], (*it).keyLength),
+				string(&variablesData[(*it).value], (*it).valueLength)));
+		}
+		return ret;
 	}
 
 	std::string Request::readHeader(const std::string key) {
@@ -207,83 +299,141 @@ namespace Mongoose
 
 	}
 
-    bool Request::readVariable(const struct mg_str data, string key, string &output)
+    string Request::get(string key, string fallback)
+    {
+        struct mg_str value;
+
+        // Looking on the query string, then on the POST data
+        if (getVariable(key, value)) {
+            return string(value.p, value.len);
+        }
+
+        return fallback;
+    }
+
+    void Request::parseCookies()
     {
-        int size = 1024, ret;
-        char *buffer = new char[size];
+        cookiesParsed = true;
 
-        do {
-            ret = mg_get_http_var(&data, key.c_str(), buffer, size);
+        // Cookie: name1=value1; name2="value2"
+        for (int i = 0; i < MG_MAX_HTTP_HEADERS && message->header_names[i].len > 0; i++) {
+            if (mg_vcasecmp(&message->header_names[i], "Cookie") != 0) {
+                continue;
+            }
 
-            if (ret == -1) {
-				delete[] buffer;
-				return false;
+            const char *p = message->header_values[i].p;
+            const char *end = p + message->header_values[i].len;
+
+            while (p < end) {
+                const char *next = (const char *) memchr(p, ';', end - p);
+                if (next == NULL) {
+                    next = end;
+                }
+                while (p < next && *p == ' ') {
+                    p++;
+                }
+                const char *eq = (const char *) memchr(p, '=', next - p);
+
+                if (eq != NULL && eq > p) {
+                    Cookie cookie;
+                    const char *value = eq + 1, *valueEnd = next;
+
+                    while (valueEnd > value && valueEnd[-1] == ' ') {
+                        valueEnd--;
+                    }
+                    if (valueEnd - value >= 2 && *value == '"' && valueEnd[-1] == '"') {
+                        value++;
+                        valueEnd--;
+                    }
+                    cookie.name.p = p;
+                    cookie.name.len = eq - p;
+                    cookie.value.p = value;
+                    cookie.value.len = valueEnd - value;
+                    cookies.push_back(cookie);
+                }
+                p = next + 1;
             }
+        }
+    }
+
+    bool Request::getCookie(const string &key, struct mg_str &value)
+    {
+        if (!cookiesParsed) {
+            parseCookies();
+        }
 
-            if (ret == -2) {
-                size *= 2;
-                delete[] buffer;
-                buffer = new char[size];
+        vector<Cookie, ArenaAllocator<Cookie> >::iterator it;
+        for (it=cookies.begin(); it!=cookies.end(); it++) {
+            if ((*it).name.len == key.size() && memcmp((*it).name.p, key.c_str(), key.size()) == 0) {
+                value = (*it).value;
+                return true;
             }
-        } while (ret == -2);
+        }
 
-        output = string(buffer);
-        delete[] buffer;
+        return false;
+    }
 
-        return true;
+    string Request::getCookie(string key, string fallback)
+    {
+        struct mg_str value;
+
+        if (getCookie(key, value)) {
+            return string(value.p, value.len);
+        }
+
+        return fallback;
+    }
+            
+    void Request::_setRoute(Controller *controller, RequestHandlerBase *handler)
+    {
+        routeController = controller;
+        routeHandler = handler;
     }
 
+    RequestHandlerBase *Request::_getRoute(Controller *controller)
+    {
+        return routeController == controller ? routeHandler : NULL;
+    }
 
-    string Request::get(string key, string fallback)
+    void Request::_setParameters(const vector<string> &names, const struct mg_str *values)
     {
-        string output;
+        parametersCount = names.size();
 
-        // Looking on the query string
-        struct mg_str dataField = message->query_string;
-        if (readVariable(dataField, key, output)) {
-            return output;
+        for (int i = 0; i < parametersCount; i++) {
+            parameters[i].name = &names[i];
+            parameters[i].value = values[i];
         }
+    }
 
-        // Looking on the POST data
-//         dataField = data.c_str();
-//         if (dataField != NULL && readVariable(dataField, key, output)) {
-//             return output;
-//         }
+    bool Request::getParameter(const string &key, struct mg_str &value)
+    {
+        for (int i = 0; i < parametersCount; i++) {
+            if (parameters[i].name != NULL && *parameters[i].name == key) {
+                value = parameters[i].value;
+                return true;
+            }
+        }
 
-        return fallback;
+        return false;
     }
 
-    string Request::getCookie(string key, string fallback)
+    string Request::getParameter(string key, string fallback)
     {
-		mg_str *tmp = mg_get_http_header(message, "cookie");
-		if (tmp == NULL || tmp->len == 0) {
-			return fallback;
-		}
-		int ret = -1;
-		int size = 1024;
-		char* buffer = new char[size];
-		std::string data = std::string(tmp->p, tmp->len);
-		do {
-			ret = mg_get_cookie(data.c_str(), key.c_str(), buffer, size);
-			if (ret >= 0) {
-				std::string ret = buffer;
-				delete[] buffer;
-				return ret;
-			}
-			if (ret == -1) {
-				delete[] buffer;
-				return fallback;
-			}
-			if (ret == -3) {
-				size *= 2;
-				delete[] buffer;
-				buffer = new char[size];
-			}
-		} while (ret == -3);
-		delete[] buffer;
-		return fallback;
+        struct mg_str value;
+
+        if (getParameter(key, value)) {
+            vector<char> decoded(value.len + 1);
+            int size = mg_url_decode(value.p, value.len, &decoded[0], decoded.size(), 0);
+
+            if (size < 0) {
+                return string(value.p, value.len);
+            }
+            return string(&decoded[0], size);
+        }
+
+        return fallback;
     }
-            
+
     void Request::handleUploads()
     {
         char var_name[1024];
@@ -3,6 +3,7 @@
 
 #include <iostream>
 #include <sstream>
+#include <map>
 #include <vector>
 #ifdef ENABLE_REGEX_URL
 #include <regex>
@@ -10,14 +11,28 @@
 #include <mongoose.h>
 #include "UploadFile.h"
 #include "Response.h"
+#include "Arena.h"
 
 using namespace std;
 
+/**
+ * Maximum number of path parameters in a route
+ */
+#define MAX_ROUTE_PARAMETERS 8
+
+/**
+ * Size of the storage embedded in each request for its indexes
+ */
+#define REQUEST_ARENA_SIZE 512
+
 /**
  * Request is a wrapper for the clients requests
  */
 namespace Mongoose
 {
+    class Controller;
+    class RequestHandlerBase;
+
     class Request
     {
         public:
@@ -30,6 +45,23 @@ namespace Mongoose
              */
             void writeResponse(Response *response);
 
+            /**
+             * Copies the request so that it can be handled after the
+             * connection event, out of the poll thread. The copy owns the
+             * request data and can not write to the connection
+             *
+             * @return Request* the copy, owned by the caller
+             */
+            Request *detach();
+
+            /**
+             * Internally used to get the mongoose message of the request,
+             * owned by the request once it is detached
+             *
+             * @return struct http_message* the message
+             */
+            struct http_message *_getMessage();
+
             /**
              * Check if the variable given by key is present in GET or POST data
              *
@@ -49,6 +81,17 @@ namespace Mongoose
              */
             string get(string key, string fallback = "");
 
+            /**
+             * Gets a view of the decoded value of a GET or POST variable,
+             * the view is valid as long as the request
+             *
+             * @param string the name of the variable
+             * @param mg_str the value of the variable if it exists
+             *
+             * @return bool true if the variable is present, false else
+             */
+            bool getVariable(const string &key, struct mg_str &value);
+
             /**
              * Try to get the cookie value
              *
@@ -59,6 +102,67 @@ namespace Mongoose
              */
             string getCookie(string key, string fallback = "");
 
+            /**
+             * Gets a view of a cookie value, the view is valid as long as
+             * the request
+             *
+             * @param string the name of the cookie
+             * @param mg_str the value of the cookie if it exists
+             *
+             * @return bool true if the cookie is present, false else
+             */
+            bool getCookie(const string &key, struct mg_str &value);
+
+            /**
+             * Gets a path parameter of the route, for instance "id" for the
+             * route /users/:id
+             *
+             * @param string the name of the parameter
+             * @param string the fallback value
+             *
+             * @return the url-decoded value of the parameter if it exists,
+             *         fallback else
+             */
+            string getParameter(string key, string fallback = "");
+
+            /**
+             * Gets a view of the raw value of a path parameter, the view is
+             * valid as long as the request
+             *
+             * @param string the name of the parameter
+             * @param mg_str the value of the parameter if it exists
+             *
+             * @return bool true if the parameter is present, false else
+             */
+            bool getParameter(const string &key, struct mg_str &value);
+
+            /**
+             * Internally used by the router to set the path parameters
+             *
+             * @param vector<string> the names of the parameters of the route
+             * @param mg_str* the values, pointing in the url
+             */
+            void _setParameters(const vector<string> &names, const struct mg_str *values);
+
+            /**
+             * Internally used by the router to remember the route found, so
+             * that the controller does not look it up again
+             *
+             * @param Controller* the controller of the route
+             * @param RequestHandlerBase* the handler of the route
+             */
+            void _setRoute(Controller *controller, RequestHandlerBase *handler);
+
+            /**
+             * Internally used to get the handler of the route found
+             *
+             * @param Controller* the controller processing the request
+             *
+             * @return RequestHandlerBase* the handler, or NULL if the route
+             *         is not one of this controller
+             */
+            RequestHandlerBase *_getRoute(Controller *controller);
+
             /**
              * Handle uploads to the target directory
              *
@@ -67,6 +171,16 @@ namespace Mongoose
              */
             void handleUploads();
 
+            /**
+             * Views on the request line and the body, pointing in the
+             * connection receive buffer. They are only valid while the
+             * request is handled, use the getters below to get a copy
+             * that outlives the handler
+             */
+            const struct mg_str &getUrlView();
+            const struct mg_str &getMethodView();
+            const struct mg_str &getDataView();
+
             string getUrl();
             string getMethod();
             string getData();
@@ -79,11 +193,44 @@ namespace Mongoose
 			arg_vector getVariablesVector();
 
 #ifdef ENABLE_REGEX_URL
-            smatch getMatches();
-            bool match(string pattern);
+            /**
+             * Gets a group captured by the pattern of the route, 0 being
+             * the whole url
+             *
+             * @param int the index of the group
+             * @param string the fallback value
+             *
+             * @return string the group if it was captured, fallback else
+             */
+            string getMatch(int index, string fallback = "");
+
+            /**
+             * Gets a view of a group captured by the pattern of the route,
+             * the view is valid as long as the request
+             *
+             * @param int the index of the group
+             * @param mg_str the group if it was captured
+             *
+             * @return bool true if the group was captured
+             */
+            bool getMatch(int index, struct mg_str &value);
+
+            /**
+             * Gets the number of groups of the pattern of the route, the
+             * whole url included
+             *
+             * @return int the number of groups
+             */
+            int getMatchCount();
+
+            /**
+             * Internally used by the router to set the captured groups
+             *
+             * @param cmatch the result of the route pattern on the url
+             */
+            void _setMatches(const cmatch &matches);
 #endif
 			std::string readHeader(const std::string key);
-            bool readVariable(const struct mg_str data, string key, string &output);
 
             /**
              * Files uploaded in this request
@@ -91,11 +238,75 @@ namespace Mongoose
             vector<UploadFile> uploadFiles;
 
         protected:
-            string method;
-            string url;
-            string data;
+            /**
+             * A decoded variable, offsets are relative to variablesData
+             */
+            struct Variable
+            {
+                size_t key, keyLength;
+                size_t value, valueLength;
+            };
+
+            /**
+             * Decodes the query string and the urlencoded POST data into
+             * the variables index, this is only done on the first access
+             */
+            void parseVariables();
+
+            /**
+             * Decodes the given "k1=v1&k2=v2" data and appends it to the index
+             */
+            void indexVariables(const struct mg_str &data);
+
+            /**
+             * A cookie, pointing in the request headers
+             */
+            struct Cookie
+            {
+                struct mg_str name;
+                struct mg_str value;
+            };
+
+            /**
+             * Splits the Cookie headers into the cookies index, this is only
+             * done on the first access
+             */
+            void parseCookies();
+
+            // The indexes below are allocated here and freed with the request
+            char arenaStorage[REQUEST_ARENA_SIZE];
+            Arena arena;
+
+            bool variablesParsed;
+            vector<char, ArenaAllocator<char> > variablesData;
+            vector<Variable, ArenaAllocator<Variable> > variables;
+
+            bool cookiesParsed;
+            vector<Cookie, ArenaAllocator<Cookie> > cookies;
+
+            /**
+             * A path parameter, the name belongs to the router
+             */
+            struct Parameter
+            {
+                const string *name;
+                struct mg_str value;
+            };
+
+            Parameter parameters[MAX_ROUTE_PARAMETERS];
+            int parametersCount;
+
+            // The route found by the router
+            Controller *routeController;
+            RequestHandlerBase *routeHandler;
+
             struct mg_connection *connection;
 			struct http_message *message;
+            union socket_address remoteAddress;
+
+            // Data of a detached request
+            vector<char, ArenaAllocator<char> > ownedData;
+            struct http_message ownedMessage;
     };
 }
 
@@ -3,6 +3,7 @@
 
 #include "Request.h"
 #include "Response.h"
+#include "AsyncResponse.h"
 #include <string>
 
 namespace Mongoose
@@ -10,7 +11,22 @@ namespace Mongoose
     class RequestHandlerBase
     {
         public:
+            /**
+             * Where the route runs when the server has workers, by default
+             * this is decided by the controller
+             */
+            enum Dispatch
+            {
+                DISPATCH_DEFAULT,
+                DISPATCH_INLINE,
+                DISPATCH_WORKER
+            };
+
+            RequestHandlerBase() : dispatch(DISPATCH_DEFAULT) {}
+            virtual ~RequestHandlerBase() {}
             virtual Response *process(Request &request)=0;
+
+            Dispatch dispatch;
     };
 
     template<typename T, typename R>
@@ -44,6 +60,44 @@ namespace Mongoose
             T *controller;
             fPtr function;
     };
+
+    template<typename T, typename R>
+    class AsyncRequestHandler : public RequestHandlerBase
+    {
+        public:
+            typedef void (T::*fPtr)(Request &request, R &response, ResponseHandle *handle);
+
+            AsyncRequestHandler(T *controller_, fPtr function_)
+                : controller(controller_), function(function_)
+            {
+            }
+
+            Response *process(Request &request)
+            {
+                R *response = new R;
+                ResponseHandle *handle = new ResponseHandle(controller->getServer(), response);
+                AsyncResponse *asyncResponse = new AsyncResponse(handle);
+
+                try {
+                    controller->preProcess(request, *response);
+                    (controller->*function)(request, *response, handle);
+                } catch (string exception) {
+                    handle->_drop();
+                    delete asyncResponse;
+                    return controller->serverInternalError(exception);
+                } catch (...) {
+                    handle->_drop();
+                    delete asyncResponse;
+                    return controller->serverInternalError("Unknown error");
+                }
+
+                return asyncResponse;
+            }
+
+        protected:
+            T *controller;
+            fPtr function;
+    };
 }
 
 #endif
@@ -1,63 +1,229 @@
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
 #include <sstream>
 #include "Response.h"
+#include "Session.h"
+#include "Mutex.h"
 
 using namespace std;
 
+static Mongoose::Mutex dateMutex;
+static time_t dateTime = 0;
+static char dateHeader[64];
+
+/**
+ * Formats the Date header value, this is done at most once per second
+ */
+static size_t getDate(char *buffer, size_t size)
+{
+    time_t now = time(NULL);
+
+    dateMutex.lock();
+    if (now != dateTime) {
+        dateTime = now;
+        strftime(dateHeader, sizeof(dateHeader), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&now));
+    }
+    size_t length = strlen(dateHeader);
+    if (length > size) {
+        length = size;
+    }
+    memcpy(buffer, dateHeader, length);
+    dateMutex.unlock();
+
+    return length;
+}
+
 namespace Mongoose
 {
-    Response::Response() : code(HTTP_OK), headers()
+    Response::Response()
+        : code(HTTP_OK), session(NULL), arena(arenaStorage, sizeof(arenaStorage)),
+        headers(ArenaAllocator<header_entry>(&arena))
     {
     }
             
     Response::~Response()
     {
+        if (session != NULL) {
+            delete session;
+        }
+    }
+
+    Response::header_entry *Response::findHeader(const string &key)
+    {
+        vector<header_entry, ArenaAllocator<header_entry> >::iterator it;
+        for (it=headers.begin(); it!=headers.end(); it++) {
+            if ((*it).first.size() == key.size() && key.compare(0, key.size(), (*it).first.data(), key.size()) == 0) {
+                return &(*it);
+            }
+        }
+
+        return NULL;
     }
             
     void Response::setHeader(string key, string value)
     {
-        headers[key] = value;
+        header_entry *header = findHeader(key);
+
+        if (header != NULL) {
+            header->second.assign(value.data(), value.size());
+        } else {
+            ArenaAllocator<char> allocator(&arena);
+            headers.push_back(header_entry(arena_string(key.data(), key.size(), allocator),
+                        arena_string(value.data(), value.size(), allocator)));
+        }
     }
 
     bool Response::hasHeader(string key)
     {
-        return headers.find(key) != headers.end();
+        return findHeader(key) != NULL;
+    }
+
+    bool Response::getBodyData(struct mg_str &)
+    {
+        return false;
     }
 
     string Response::getData()
     {
-        string body = getBody();
+        string built;
+        struct mg_str body;
         ostringstream data;
 
+        if (!getBodyData(body)) {
+            built = getBody();
+            body = mg_mk_str_n(built.data(), built.size());
+        }
+
         data << "HTTP/1.0 " << code << "\r\n";
 
         if (!hasHeader("Content-Length")) {
             ostringstream length;
-            length << body.size();
+            length << body.len;
             setHeader("Content-Length", length.str());
         }
 
-        map<string, string>::iterator it;
+        vector<header_entry, ArenaAllocator<header_entry> >::iterator it;
         for (it=headers.begin(); it!=headers.end(); it++) {
-            data << (*it).first << ": " << (*it).second << "\r\n";
+            data.write((*it).first.data(), (*it).first.size()) << ": ";
+            data.write((*it).second.data(), (*it).second.size()) << "\r\n";
         }
 
         data << "\r\n";
 
-        data << body;
+        data.write(body.p, body.len);
 
         return data.str();
     }
 
+    void Response::writeHead(struct mg_connection *connection, size_t bodySize, bool chunked)
+    {
+        char status[32], length[64], date[64];
+        int statusSize = snprintf(status, sizeof(status), "HTTP/1.%d %d\r\n", chunked ? 1 : 0, code);
+        int lengthSize = 0, dateSize = 0;
+        size_t size = statusSize + 2 + bodySize;
+
+        if (chunked) {
+            lengthSize = snprintf(length, sizeof(length), "Transfer-Encoding: chunked\r\n");
+            size += lengthSize;
+        } else if (!hasHeader("Content-Length")) {
+            lengthSize = snprintf(length, sizeof(length), "Content-Length: %lu\r\n", (unsigned long) bodySize);
+            size += lengthSize;
+        }
+        if (!hasHeader("Date")) {
+            memcpy(date, "Date: ", 6);
+            dateSize = 6 + getDate(date + 6, sizeof(date) - 8);
+            memcpy(date + dateSize, "\r\n", 2);
+            dateSize += 2;
+            size += dateSize;
+        }
+
+        vector<header_entry, ArenaAllocator<header_entry> >::iterator it;
+        for (it=headers.begin(); it!=headers.end(); it++) {
+            size += (*it).first.size() + (*it).second.size() + 4;
+        }
+
+        // Reserving the whole response once, the sends below only append
+        struct mbuf *io = &connection->send_mbuf;
+        if (io->size < io->len + size) {
+            mbuf_resize(io, io->len + size);
+        }
+
+        mg_send(connection, status, statusSize);
+        for (it=headers.begin(); it!=headers.end(); it++) {
+            mg_send(connection, (*it).first.data(), (*it).first.size());
+            mg_send(connection, ": ", 2);
+            mg_send(connection, (*it).second.data(), (*it).second.size());
+            mg_send(connection, "\r\n", 2);
+        }
+        if (lengthSize > 0) {
+            mg_send(connection, length, lengthSize);
+        }
+        if (dateSize > 0) {
+            mg_send(connection, date, dateSize);
+        }
+        mg_send(connection, "\r\n", 2);
+    }
+
+    void Response::write(struct mg_connection *connection)
+    {
+        struct mg_str body;
+
+        // The body is sent from where the response keeps it when it can
+        if (getBodyData(body)) {
+            writeHead(connection, body.len);
+            if (body.len > 0) {
+                mg_send(connection, body.p, body.len);
+            }
+        } else {
+            string built = getBody();
+
+            writeHead(connection, built.size());
+            mg_send(connection, built.data(), built.size());
+        }
+    }
+
+    bool Response::isComplete()
+    {
+        return true;
+    }
+
+    void Response::poll(struct mg_connection *)
+    {
+    }
+
     void Response::setCookie(string key, string value)
     {
-        ostringstream definition;
-        definition << key << "=" << value << "; path=/";
+        ArenaAllocator<char> allocator(&arena);
+        arena_string definition(allocator);
+
+        definition.reserve(key.size() + value.size() + 9);
+        definition.append(key.data(), key.size()).append("=");
+        definition.append(value.data(), value.size()).append("; path=/");
 
-        setHeader("Set-cookie", definition.str());
+        header_entry *header = findHeader("Set-cookie");
+        if (header != NULL) {
+            header->second = definition;
+        } else {
+            headers.push_back(header_entry(arena_string("Set-cookie", allocator), definition));
+        }
     }
 
     void Response::setCode(int code_)
     {
         code = code_;
     }
+
+    void Response::_setSession(Session *session_)
+    {
+        if (session != NULL) {
+            delete session;
+        }
+        session = session_;
+    }
+
+    Session *Response::_getSession()
+    {
+        return session;
+    }
 }
@@ -1,15 +1,24 @@
 #ifndef _MONGOOSE_RESPONSE_H
 #define _MONGOOSE_RESPONSE_H
 
-#include <map>
+#include <vector>
 #include <sstream>
 #include <iostream>
+#include <mongoose.h>
+
+#include "Arena.h"
 
 #define HTTP_OK 200
 #define HTTP_NOT_FOUND 404
 #define HTTP_FORBIDDEN 403
 #define HTTP_SERVER_ERROR 500
 
+/**
+ * Size of the storage embedded in each response for its headers and body,
+ * beyond that the response arena takes blocks from the heap
+ */
+#define RESPONSE_ARENA_SIZE 1024
+
 using namespace std;
 
 /**
@@ -17,6 +26,8 @@ using namespace std;
  */
 namespace Mongoose
 {
+    class Session;
+
     class Response 
     {
         public:
@@ -49,6 +60,29 @@ namespace Mongoose
              */
             virtual string getData();
 
+            /**
+             * Serializes the response directly in the connection send queue
+             *
+             * @param struct mg_connection* the connection to write to
+             */
+            virtual void write(struct mg_connection *connection);
+
+            /**
+             * Is the response fully written? A response that is not will be
+             * polled by the server each time its connection can take more data
+             *
+             * @return bool true if the response is complete
+             */
+            virtual bool isComplete();
+
+            /**
+             * Called by the server when the connection of an incomplete
+             * response can take more data
+             *
+             * @param struct mg_connection* the connection to write to
+             */
+            virtual void poll(struct mg_connection *connection);
+
             /**
              * Gets the response body
              *
@@ -56,6 +90,16 @@ namespace Mongoose
              */
             virtual string getBody()=0;
 
+            /**
+             * Gets the response body in place, for the responses keeping it
+             * in one piece, so that it is written without being copied first
+             *
+             * @param struct mg_str the body, valid until the response changes
+             *
+             * @return bool false if the body is only given by getBody()
+             */
+            virtual bool getBodyData(struct mg_str &body);
+
             /**
              * Sets the cookie, note that you can only define one cookie by request
              * for now
@@ -70,9 +114,51 @@ namespace Mongoose
              */
             virtual void setCode(int code);
 
+            /**
+             * Attaches a session living as long as the response, this is
+             * used by the sessions that are not stored on the server
+             *
+             * @param Session* the session, deleted with the response
+             */
+            void _setSession(Session *session);
+
+            /**
+             * Gets the session attached to the response
+             *
+             * @return Session* the session, or NULL
+             */
+            Session *_getSession();
+
         protected:
+            /**
+             * Writes the status line and the headers in the connection send
+             * queue, reserving room for the body that follows
+             *
+             * @param struct mg_connection* the connection to write to
+             * @param size_t the size of the body
+             * @param bool chunked true if the body will be sent in chunks
+             */
+            void writeHead(struct mg_connection *connection, size_t bodySize, bool chunked = false);
+
+            typedef pair<arena_string, arena_string> header_entry;
+
+            /**
+             * Finds a header by name
+             *
+             * @param string the header key
+             *
+             * @return header_entry* the header, or NULL
+             */
+            header_entry *findHeader(const string &key);
+
             int code;
-            map<string, string> headers;
+            Session *session;
+
+            // Everything the response holds is allocated here and freed with it
+            char arenaStorage[RESPONSE_ARENA_SIZE];
+            Arena arena;
+
+            vector<header_entry, ArenaAllocator<header_entry> > headers;
     };
 }
 
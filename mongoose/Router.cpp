@@ -0,0 +1,319 @@
+#include <string.h>
+#include "Router.h"
+
+using namespace std;
+
+namespace Mongoose
+{
+    Router::Router()
+        : root(new Node)
+    {
+    }
+
+    Router::~Router()
+    {
+        destroy(root);
+    }
+
+    void Router::destroy(Node *node)
+    {
+        vector<Node *>::iterator it;
+        for (it = node->children.begin(); it != node->children.end(); it++) {
+            destroy(*it);
+        }
+        if (node->parameter != NULL) {
+            destroy(node->parameter);
+        }
+        delete node;
+    }
+
+    Router::Node *Router::insert(Node *node, const string &text)
+    {
+        if (text.empty()) {
+            return node;
+        }
+
+        vector<Node *>::iterator it;
+        for (it = node->children.begin(); it != node->children.end(); it++) {
+            Node *child = *it;
+            size_t common = 0;
+
+            while (common < child->prefix.size() && common < text.size() &&
+                    child->prefix[common] == text[common]) {
+                common++;
+            }
+            if (common == 0) {
+                continue;
+            }
+
+            // Splits the edge where the texts differ
+            if (common < child->prefix.size()) {
+                Node *middle = new Node;
+                middle->prefix = child->prefix.substr(0, common);
+                child->prefix = child->prefix.substr(common);
+                middle->children.push_back(child);
+                *it = middle;
+                child = middle;
+            }
+
+            return insert(child, text.substr(common));
+        }
+
+        Node *child = new Node;
+        child->prefix = text;
+        node->children.push_back(child);
+
+        return child;
+    }
+
+    int Router::countParameters(const string &path)
+    {
+        int count = 0;
+
+        for (size_t i = 0; i < path.size(); i++) {
+            if (path[i] == ':' && (i == 0 || path[i-1] == '/')) {
+                count++;
+            }
+        }
+
+        return count;
+    }
+
+    bool Router::add(string method, string path, Controller *controller, RequestHandlerBase *handler)
+    {
+        Node *node = root;
+        vector<string> parameters;
+        size_t i = 0;
+
+        // The lookup could never match it
+        if (countParameters(path) > MAX_ROUTE_PARAMETERS) {
+            return false;
+        }
+
+        while (i < path.size()) {
+            if (path[i] == ':' && (i == 0 || path[i-1] == '/')) {
+                size_t end = path.find('/', i);
+                if (end == string::npos) {
+                    end = path.size();
+                }
+                parameters.push_back(path.substr(i + 1, end - i - 1));
+                if (node->parameter == NULL) {
+                    node->parameter = new Node;
+                }
+                node = node->parameter;
+                i = end;
+            } else {
+                size_t end = path.find("/:", i);
+                end = (end == string::npos) ? path.size() : end + 1;
+                node = insert(node, path.substr(i, end - i));
+                i = end;
+            }
+        }
+
+        vector<Route>::iterator it;
+        for (it = node->routes.begin(); it != node->routes.end(); it++) {
+            if ((*it).method == method) {
+                if ((*it).match.controller != controller) {
+                    return false;
+                }
+                (*it).parameters = parameters;
+                (*it).match.handler = handler;
+                return true;
+            }
+        }
+
+        Route route;
+        route.method = method;
+        route.parameters = parameters;
+        route.match.controller = controller;
+        route.match.handler = handler;
+        node->routes.push_back(route);
+
+        return true;
+    }
+
+    Router::Route *Router::lookup(Node *node, const char *p, const char *end,
+            const struct mg_str &method, struct mg_str *values, int depth)
+    {
+        Route *route;
+
+        if (p == end) {
+            vector<Route>::iterator it;
+            for (it = node->routes.begin(); it != node->routes.end(); it++) {
+                if (mg_vcmp(&method, (*it).method.c_str()) == 0) {
+                    return &(*it);
+                }
+            }
+            return NULL;
+        }
+
+        vector<Node *>::iterator it;
+        for (it = node->children.begin(); it != node->children.end(); it++) {
+            const string &prefix = (*it)->prefix;
+
+            if (prefix[0] == *p && prefix.size() <= (size_t) (end - p) &&
+                    memcmp(prefix.c_str(), p, prefix.size()) == 0) {
+                if ((route = lookup(*it, p + prefix.size(), end, method, values, depth)) != NULL) {
+                    return route;
+                }
+                // Children have distinct first characters
+                break;
+            }
+        }
+
+        if (node->parameter != NULL && depth < MAX_ROUTE_PARAMETERS && *p != '/') {
+            const char *segmentEnd = p;
+            while (segmentEnd < end && *segmentEnd != '/') {
+                segmentEnd++;
+            }
+            values[depth].p = p;
+            values[depth].len = segmentEnd - p;
+
+            return lookup(node->parameter, segmentEnd, end, method, values, depth + 1);
+        }
+
+        return NULL;
+    }
+
+#ifdef ENABLE_REGEX_URL
+    /**
+     * Gets the text every url matching the pattern starts with
+     */
+    static string literal_prefix(const string &pattern)
+    {
+        string prefix;
+        size_t i = (!pattern.empty() && pattern[0] == '^') ? 1 : 0;
+
+        // Any alternative could start differently
+        if (pattern.find('|') != string::npos) {
+            return prefix;
+        }
+
+        for (; i < pattern.size(); i++) {
+            char c = pattern[i];
+
+            if (strchr(".[]()*+?{}^$\\", c) != NULL) {
+                // The last character is optional
+                if ((c == '*' || c == '?' || c == '{') && !prefix.empty()) {
+                    prefix.erase(prefix.size() - 1);
+                }
+                break;
+            }
+            prefix += c;
+        }
+
+        return prefix;
+    }
+
+    bool Router::addPattern(string method, string pattern, Controller *controller, RequestHandlerBase *handler)
+    {
+        PatternGroup *group = NULL;
+
+        vector<PatternGroup>::iterator it;
+        for (it = patterns.begin(); it != patterns.end(); it++) {
+            if ((*it).method == method) {
+                group = &(*it);
+                break;
+            }
+        }
+        if (group == NULL) {
+            patterns.push_back(PatternGroup());
+            group = &patterns.back();
+            group->method = method;
+        }
+
+        vector<PatternRoute>::iterator rit;
+        for (rit = group->routes.begin(); rit != group->routes.end(); rit++) {
+            if ((*rit).source == pattern) {
+                if ((*rit).match.controller != controller) {
+                    return false;
+                }
+                (*rit).match.handler = handler;
+                return true;
+            }
+        }
+
+        PatternRoute route;
+        route.source = pattern;
+        route.prefix = literal_prefix(pattern);
+        route.pattern = regex(pattern, regex::ECMAScript | regex::optimize);
+        route.match.controller = controller;
+        route.match.handler = handler;
+        group->routes.push_back(route);
+
+        return true;
+    }
+
+    Router::PatternRoute *Router::lookupPattern(const struct mg_str &method, const struct mg_str &url, cmatch &matches)
+    {
+        vector<PatternGroup>::iterator it;
+        for (it = patterns.begin(); it != patterns.end(); it++) {
+            if (mg_vcmp(&method, (*it).method.c_str()) != 0) {
+                continue;
+            }
+
+            vector<PatternRoute>::iterator rit;
+            for (rit = (*it).routes.begin(); rit != (*it).routes.end(); rit++) {
+                const string &prefix = (*rit).prefix;
+
+                if (prefix.size() <= url.len && memcmp(prefix.c_str(), url.p, prefix.size()) == 0 &&
+                        regex_match(url.p, url.p + url.len, matches, (*rit).pattern)) {
+                    return &(*rit);
+                }
+            }
+            break;
+        }
+
+        return NULL;
+    }
+#endif
+
+    bool Router::find(Request &request, Match &match)
+    {
+        const struct mg_str &url = request.getUrlView();
+        struct mg_str values[MAX_ROUTE_PARAMETERS];
+        Route *route = lookup(root, url.p, url.p + url.len, request.getMethodView(), values, 0);
+
+        if (route != NULL) {
+            request._setParameters(route->parameters, values);
+            match = route->match;
+            request._setRoute(match.controller, match.handler);
+            return true;
+        }
+
+#ifdef ENABLE_REGEX_URL
+        cmatch matches;
+        PatternRoute *patternRoute = lookupPattern(request.getMethodView(), url, matches);
+
+        if (patternRoute != NULL) {
+            request._setMatches(matches);
+            match = patternRoute->match;
+            request._setRoute(match.controller, match.handler);
+            return true;
+        }
+#endif
+
+        return false;
+    }
+
+    bool Router::handles(string method, string url)
+    {
+        struct mg_str methodView = mg_mk_str_n(method.c_str(), method.size());
+        struct mg_str values[MAX_ROUTE_PARAMETERS];
+
+        if (lookup(root, url.c_str(), url.c_str() + url.size(), methodView, values, 0) != NULL) {
+            return true;
+        }
+
+#ifdef ENABLE_REGEX_URL
+        struct mg_str urlView = mg_mk_str_n(url.c_str(), url.size());
+        cmatch matches;
+
+        if (lookupPattern(methodView, urlView, matches) != NULL) {
+            return true;
+        }
+#endif
+
+        return false;
+    }
+}
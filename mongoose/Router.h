@@ -0,0 +1,168 @@
+#ifndef _MONGOOSE_ROUTER_H
+#define _MONGOOSE_ROUTER_H
+
+#include <string>
+#include <vector>
+#ifdef ENABLE_REGEX_URL
+#include <regex>
+#endif
+#include <mongoose.h>
+#include "Request.h"
+#include "RequestHandler.h"
+
+using namespace std;
+
+/**
+ * The routes of all the controllers of a server, in a radix tree
+ *
+ * Route paths can contain parameters, like /users/:id, matching a whole
+ * path segment. Static segments are tried before parameters, and the
+ * first controller registering a method and path keeps it
+ *
+ * With ENABLE_REGEX_URL, the routes are regex patterns compiled when they
+ * are added. They are grouped by method and only the patterns whose
+ * literal prefix starts the url are run, in the order they were added
+ */
+namespace Mongoose
+{
+    class Controller;
+
+    class Router
+    {
+        public:
+            /**
+             * A resolved route
+             */
+            struct Match
+            {
+                Controller *controller;
+                RequestHandlerBase *handler;
+            };
+
+            Router();
+            virtual ~Router();
+
+            /**
+             * Adds a route
+             *
+             * @param string the HTTP method
+             * @param string the path, parameters are segments starting with ':'
+             * @param Controller* the controller owning the handler
+             * @param RequestHandlerBase* the handler
+             *
+             * @return bool false if another controller already has this route,
+             *         or if it has more than MAX_ROUTE_PARAMETERS parameters
+             */
+            bool add(string method, string path, Controller *controller, RequestHandlerBase *handler);
+
+            /**
+             * Counts the parameters of a route path
+             *
+             * @param string the path
+             *
+             * @return int the number of parameters
+             */
+            static int countParameters(const string &path);
+
+#ifdef ENABLE_REGEX_URL
+            /**
+             * Adds a route matching the urls with a regex, the captured
+             * groups are available with Request::getMatch()
+             *
+             * @param string the HTTP method
+             * @param string the pattern, matching the whole url
+             * @param Controller* the controller owning the handler
+             * @param RequestHandlerBase* the handler
+             *
+             * @return bool false if another controller already has this route
+             */
+            bool addPattern(string method, string pattern, Controller *controller, RequestHandlerBase *handler);
+#endif
+
+            /**
+             * Resolves the route of a request, the path parameters are set
+             * on the request
+             *
+             * @param Request the request
+             * @param Match the route, if found
+             *
+             * @return bool true if a route was found
+             */
+            bool find(Request &request, Match &match);
+
+            /**
+             * Is there a route for this method and url?
+             *
+             * @param string the HTTP method
+             * @param string the url
+             *
+             * @return bool true if a route was found
+             */
+            bool handles(string method, string url);
+
+        protected:
+            struct Route
+            {
+                string method;
+                vector<string> parameters;
+                Match match;
+            };
+
+            struct Node
+            {
+                Node() : parameter(NULL) {}
+
+                // Static text leading to this node from its parent
+                string prefix;
+                vector<Node *> children;
+                Node *parameter;
+                vector<Route> routes;
+            };
+
+            /**
+             * Gets the node for the given static text below a node, creating
+             * and splitting nodes as needed
+             */
+            Node *insert(Node *node, const string &text);
+
+            /**
+             * Walks the tree from a node, the parameter values are stored
+             * in values
+             *
+             * @return Route* the route found, or NULL
+             */
+            Route *lookup(Node *node, const char *p, const char *end,
+                    const struct mg_str &method, struct mg_str *values, int depth);
+
+            void destroy(Node *node);
+
+            Node *root;
+
+#ifdef ENABLE_REGEX_URL
+            struct PatternRoute
+            {
+                string source;
+                string prefix;
+                regex pattern;
+                Match match;
+            };
+
+            struct PatternGroup
+            {
+                string method;
+                vector<PatternRoute> routes;
+            };
+
+            /**
+             * Runs the patterns of the method on the url
+             *
+             * @return PatternRoute* the first matching route, or NULL
+             */
+            PatternRoute *lookupPattern(const struct mg_str &method, const struct mg_str &url, cmatch &matches);
+
+            vector<PatternGroup> patterns;
+#endif
+    };
+}
+
+#endif
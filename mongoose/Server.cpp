@@ -10,10 +10,18 @@
 #include <iostream>
 #include "Server.h"
 #include "Utils.h"
+#ifdef ENABLE_WEBSOCKET_DEFLATE
+#include "WebSocketDeflate.h"
+#endif
 
 using namespace std;
 using namespace Mongoose;
 
+/**
+ * Set on connections having a response that is still being written
+ */
+#define MG_F_PENDING_RESPONSE MG_F_USER_1
+
 static int getTime()
 {
 #ifdef _MSC_VER
@@ -25,6 +33,19 @@ static int getTime()
 #endif
 }
 
+/**
+ * Serves the requests that are not handled by a controller from the disk
+ */
+static void serve_static(struct mg_connection *connection, struct http_message *message)
+{
+	static struct mg_serve_http_opts s_http_server_opts;
+
+	s_http_server_opts.document_root = "C:\\source\\build\\x64\\dev\\web";  // Serve current directory
+	s_http_server_opts.enable_directory_listing = "yes";
+
+	mg_serve_http(connection, message, s_http_server_opts);
+}
+
 /**
  * The handlers below are written in C to do the binding of the C mongoose with
  * the C++ API
@@ -32,36 +53,74 @@ static int getTime()
 static void event_handler(struct mg_connection *connection, int ev, void *ev_data)
 {
 	struct http_message *message = (struct http_message *) ev_data;
-    Server *server = (Server *)connection->user_data;
+    Server *server = (Server *)connection->mgr->user_data;
 
 	if (server != NULL) {
 		if (ev == MG_EV_HTTP_REQUEST) {
+			if (!server->_handleRequest(connection, message)) {
+				serve_static(connection, message);
+			}
 #ifndef NO_WEBSOCKET
-			if (connection->is_websocket) {
-				server->_webSocketReady(connection, message);
+		} else if (connection->flags & MG_F_IS_WEBSOCKET) {
+			if (ev == MG_EV_WEBSOCKET_HANDSHAKE_REQUEST) {
+				server->_webSocketHandshake(connection, message);
+			} else if (ev == MG_EV_WEBSOCKET_HANDSHAKE_DONE) {
+				server->_webSocketReady(connection);
+			} else if (ev == MG_EV_WEBSOCKET_FRAME) {
+				struct websocket_message *frame = (struct websocket_message *) ev_data;
+				server->_webSocketData(connection, mg_mk_str_n((const char *) frame->data, frame->size), frame->flags);
+			} else if (ev == MG_EV_POLL || ev == MG_EV_SEND) {
+				server->_webSocketFlush(connection);
+			} else if (ev == MG_EV_CLOSE) {
+				server->_webSocketClosed(connection);
 			}
 #endif
-			if (!server->_handleRequest(connection, message)) {
-				static struct mg_serve_http_opts s_http_server_opts;
-
-				s_http_server_opts.document_root = "C:\\source\\build\\x64\\dev\\web";  // Serve current directory
-				s_http_server_opts.enable_directory_listing = "yes";
-
-				mg_serve_http(connection, message, s_http_server_opts);
+		} else if (connection->flags & MG_F_PENDING_RESPONSE) {
+			if (ev == MG_EV_POLL || ev == MG_EV_SEND) {
+				server->_pollResponse(connection);
+			} else if (ev == MG_EV_CLOSE) {
+				server->_closeResponse(connection);
 			}
 		}
     }
 }
 
-#ifndef NO_WEBSOCKET
-static int iterate_callback(struct mg_connection *connection)
+static void wakeup_handler(struct mg_connection *connection, int ev, void *)
 {
-    if (connection->is_websocket && connection->content_len) {
-        Server *server = (Server *)connection->server_param;
-        server->_webSocketData(connection, string(connection->content, connection->content_len));
+    Server *server = (Server *)connection->user_data;
+
+    if (ev == MG_EV_RECV && server != NULL) {
+        mbuf_remove(&connection->recv_mbuf, connection->recv_mbuf.len);
+        server->_runTasks(connection);
+#ifndef NO_WEBSOCKET
+        server->_flushWebSockets();
+#endif
     }
+}
 
-    return 1;
+#ifdef ENABLE_WEBSOCKET_DEFLATE
+/**
+ * Answers the handshake of a websocket with the extension agreed, mongoose
+ * then does not send its own
+ */
+static void send_websocket_handshake(struct mg_connection *connection, const struct mg_str *key, const string &extension)
+{
+    static const char *magic = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    unsigned char sha[20];
+    char accept[32];
+    cs_sha1_ctx context;
+
+    cs_sha1_init(&context);
+    cs_sha1_update(&context, (const unsigned char *) key->p, key->len);
+    cs_sha1_update(&context, (const unsigned char *) magic, strlen(magic));
+    cs_sha1_final(sha, &context);
+    cs_base64_encode(sha, sizeof(sha), accept);
+
+    mg_printf(connection, "HTTP/1.1 101 Switching Protocols\r\n"
+            "Upgrade: websocket\r\n"
+            "Connection: Upgrade\r\n"
+            "Sec-WebSocket-Accept: %s\r\n"
+            "Sec-WebSocket-Extensions: %s\r\n\r\n", accept, extension.c_str());
 }
 #endif
 
@@ -73,31 +132,122 @@ static void *server_poll(void *param)
     return NULL;
 }
 
+static void *server_snapshot(void *param)
+{
+    Server *server = (Server *)param;
+    server->_snapshot();
+
+    return NULL;
+}
+
 namespace Mongoose
 {
+    /**
+     * Dispatches a request once its session is loaded
+     */
+    class DispatchTask : public ServerTask
+    {
+        public:
+            DispatchTask(Server *server_, Controller *controller_, Request *request_, ResponseHandle *handle_)
+                : server(server_), controller(controller_), request(request_), handle(handle_)
+            {
+            }
+
+            virtual ~DispatchTask()
+            {
+                // The session could not be loaded, there is nobody to answer
+                // once the server is stopped
+                if (handle != NULL) {
+                    if (server->_isStopped()) {
+                        handle->_drop();
+                    } else {
+                        handle->complete(controller->serverInternalError("Sessions unavailable"));
+                    }
+                }
+                delete request;
+            }
+
+            void run(Server *)
+            {
+                Response *response = controller->process(*request);
+                ResponseHandle *completed = handle;
+
+                handle = NULL;
+                completed->complete(response);
+            }
+
+        protected:
+            Server *server;
+            Controller *controller;
+            Request *request;
+            ResponseHandle *handle;
+    };
+
     Server::Server(const char *port_, const char *documentRoot)
         :  stopped(false)
 		, destroyed(true)
 		, port(port_)
-#ifndef NO_WEBSOCKET 
-        , websockets(NULL)
+        , sessions(&defaultSessions)
+        , wakeupPending(false)
+        , workers(0)
+        , executor(NULL)
+        , snapshotInterval(0)
+        , snapshotRunning(false)
+        , snapshotted(0)
+#ifndef NO_WEBSOCKET
+        , websockets(true)
+        , highWatermark(WEBSOCKET_HIGH_WATERMARK)
+        , lowWatermark(WEBSOCKET_LOW_WATERMARK)
+        , overflow(WebSocket::OVERFLOW_DISCONNECT)
+#ifdef ENABLE_WEBSOCKET_DEFLATE
+        , deflateWindowBits(0)
+        , deflateThreshold(0)
+        , deflateContextTakeover(true)
+#endif
 #endif
 
     {
 		//memset(&mgr, 0, sizeof(mgr));
-		mgr.user_data = this;
-		mg_mgr_init(&mgr, NULL);
+		mg_mgr_init(&mgr, this);
 		memset(&opts, 0, sizeof(opts));
+        wakeupSockets[0] = wakeupSockets[1] = INVALID_SOCKET;
         optionsMap["document_root"] = string(documentRoot);
     }
 
     Server::~Server()
     {
         stop();
+        if (executor != NULL) {
+            delete executor;
+        }
+
+        // Tasks posted after the poll thread stopped are never run, they
+        // may still refer to the controllers
+        vector<ServerTask *>::iterator tit;
+        for (tit = tasks.begin(); tit != tasks.end(); tit++) {
+            delete (*tit);
+        }
+        tasks.clear();
+
 		vector<Controller *>::iterator it;
 		for (it = controllers.begin(); it != controllers.end(); it++) {
 			delete (*it);
 		}
+        if (wakeupSockets[0] != INVALID_SOCKET) {
+            closesocket(wakeupSockets[0]);
+        }
+
+#ifndef NO_WEBSOCKET
+        WebSocketMessage *message = (WebSocketMessage *) outbound.exchange(NULL);
+        while (message != NULL) {
+            WebSocketMessage *next = message->next;
+            if (message->frame != NULL) {
+                message->frame->release();
+            }
+            delete message;
+            message = next;
+        }
+#endif
     }
 
 	void Server::setSsl(const char *certificate) {
@@ -109,13 +259,22 @@ namespace Mongoose
     {
 		const char *err = "";
 		opts.error_string = &err;
-		opts.user_data = this;
 		server_connection = mg_bind_opt(&mgr, port.c_str(), event_handler, opts);
 		if (server_connection == NULL) {
 			throw mongoose_exception(err);
 		}
 		mg_set_protocol_http_websocket(server_connection);
 
+        // The poll thread owns wakeupSockets[1], writing to wakeupSockets[0]
+        // from any thread makes mg_mgr_poll() return
+        if (wakeupSockets[0] == INVALID_SOCKET) {
+            if (!mg_socketpair(wakeupSockets, SOCK_DGRAM)) {
+                throw mongoose_exception("Unable to create the wakeup socket pair");
+            }
+            struct mg_connection *wakeup = mg_add_sock(&mgr, wakeupSockets[1], wakeup_handler);
+            wakeup->user_data = this;
+        }
+
 
         // size_t size = optionsMap.size()*2+1;
 
@@ -126,6 +285,13 @@ namespace Mongoose
 // 					throw string("Failed to set " + (*it).first + ": " + err);
 // 			}
 
+        if (workers > 0 && executor == NULL) {
+            executor = new Executor(workers);
+        }
+        if (executor != NULL) {
+            executor->start();
+        }
+
         stopped = false;
 
         mg_start_thread(server_poll, this);
@@ -136,61 +302,173 @@ namespace Mongoose
 		if (!stopped)
 			destroyed = false;
         // unsigned int current_timer = 0;
+        time_t collected = time(NULL);
         while (!stopped) {
 			mg_mgr_poll(&mgr, 1000);
-#ifndef NO_WEBSOCKET
-            mg_iterate_over_connections(server, iterate_callback, &current_timer);
-#endif
+
+            // Expiring the sessions between polls keeps it off the requests,
+            // this only costs the sessions being removed
+            time_t now = time(NULL);
+            if (now != collected) {
+                collected = now;
+                sessions->garbageCollect();
+
+                // Written in the background, the requests go on meanwhile
+                if (!snapshotPath.empty() && !snapshotRunning && now - snapshotted >= snapshotInterval) {
+                    snapshotted = now;
+                    snapshotRunning = true;
+                    mg_start_thread(server_snapshot, this);
+                }
+            }
         }
 
-        destroyed = true;
+		// The websockets are released as their connections are closed
 		mg_mgr_free(&mgr);
+        destroyed = true;
     }
 
     void Server::stop()
     {
+        // ~Server stops the server again, the snapshot is written once
+        bool running = !stopped;
+
         stopped = true;
+        post(NULL);
         while (!destroyed) {
             Utils::xsleep(100);
         }
+
+        // The connections are closed, what the workers complete is dropped
+        if (executor != NULL) {
+            executor->stop();
+        }
+
+        // The last snapshot has all the sessions for the next start
+        if (running && !snapshotPath.empty()) {
+            while (snapshotRunning) {
+                Utils::xsleep(10);
+            }
+            sessions->save(snapshotPath);
+        }
+    }
+
+    void Server::setSnapshot(string path, int interval)
+    {
+        snapshotPath = path;
+        snapshotInterval = interval;
+        snapshotted = time(NULL);
+        sessions->load(path);
+    }
+
+    void Server::_snapshot()
+    {
+        sessions->save(snapshotPath);
+        snapshotRunning = false;
+    }
+
+    void Server::setWorkers(int workers_)
+    {
+        workers = workers_;
+    }
+
+    Executor *Server::getExecutor()
+    {
+        return executor;
     }
 
     void Server::registerController(Controller *controller)
     {
-        controller->setSessions(&sessions);
+        // The routes are added to the router as setup() registers them
+        controller->setSessions(sessions);
         controller->setServer(this);
         controller->setup();
         controllers.push_back(controller);
     }
 
-#ifndef NO_WEBSOCKET
-    void Server::_webSocketReady(struct mg_connection *conn)
+    void Server::setSessions(Sessions *sessions_)
     {
-        WebSocket *websocket = new WebSocket(conn);
-        websockets.add(websocket);
-        websockets.clean();
+        sessions = sessions_;
 
         vector<Controller *>::iterator it;
         for (it=controllers.begin(); it!=controllers.end(); it++) {
-            (*it)->webSocketReady(websocket);
+            (*it)->setSessions(sessions);
+        }
+    }
+
+    Sessions &Server::getSessions()
+    {
+        return *sessions;
+    }
+
+    Router &Server::getRouter()
+    {
+        return router;
+    }
+
+#ifndef NO_WEBSOCKET
+    void Server::_webSocketHandshake(struct mg_connection *conn, struct http_message *message)
+    {
+        Request request(conn, message);
+        WebSocket *websocket = new WebSocket(this, conn, request.detach());
+        websocket->setBackpressure(highWatermark, lowWatermark, overflow);
+
+#ifdef ENABLE_WEBSOCKET_DEFLATE
+        struct mg_str *offers = mg_get_http_header(message, "Sec-WebSocket-Extensions");
+        struct mg_str *key = mg_get_http_header(message, "Sec-WebSocket-Key");
+        WebSocketDeflate::Parameters parameters;
+        string extension;
+
+        if (deflateWindowBits > 0 && offers != NULL && key != NULL &&
+                WebSocketDeflate::negotiate(*offers, deflateWindowBits, deflateContextTakeover, parameters, extension)) {
+            websocket->_setDeflate(new WebSocketDeflate(parameters), deflateThreshold);
+            send_websocket_handshake(conn, key, extension);
         }
+#endif
+
+        // The user data of a websocket connection is its WebSocket, the
+        // other connections have none
+        websockets.add(websocket);
+        conn->user_data = websocket;
     }
 
-    int Server::_webSocketData(struct mg_connection *conn, string data)
+    void Server::_webSocketReady(struct mg_connection *conn)
     {
-        WebSocket *websocket = websockets.getWebSocket(conn);
+        WebSocket *websocket = (WebSocket *) conn->user_data;
 
         if (websocket != NULL) {
-            websocket->appendData(data);
+            vector<Controller *>::iterator it;
+            for (it=controllers.begin(); it!=controllers.end(); it++) {
+                (*it)->webSocketReady(websocket);
+            }
+
+            // The fragments are then given as they come, in place
+            if (websocket->isStreaming()) {
+                conn->flags |= MG_F_WEBSOCKET_NO_DEFRAG;
+            }
+        }
+    }
 
-            string fullPacket = websocket->flushData();
+    int Server::_webSocketData(struct mg_connection *conn, struct mg_str data, int flags)
+    {
+        WebSocket *websocket = (WebSocket *) conn->user_data;
+
+        if (websocket != NULL) {
+            // A compressed message that can't be inflated ends the connection
+            if (!websocket->_receive(data, flags)) {
+                websocket->close();
+                return 0;
+            }
+
+            // The data are given in place, the receive buffer is left to the
+            // controllers, to gather streamed fragments
+            int opcode = websocket->getOpcode();
             vector<Controller *>::iterator it;
             for (it=controllers.begin(); it!=controllers.end(); it++) {
-                (*it)->webSocketData(websocket, fullPacket);
+                (*it)->webSocketData(websocket, data, opcode);
             }
 
+            // The websocket is released when the connection is closed
             if (websocket->isClosed()) {
-                websockets.remove(websocket);
                 return 0;
             } else {
                 return -1;
@@ -199,23 +477,243 @@ namespace Mongoose
             return 0;
         }
     }
+
+    void Server::_webSocketSend(const vector<int> &ids, WebSocketFrame *frame)
+    {
+        WebSocketMessage *message = new WebSocketMessage;
+        message->ids = ids;
+        message->frame = frame;
+        frame->acquire();
+
+        pushWebSocketMessage(message);
+    }
+
+    void Server::_webSocketClose(int id)
+    {
+        WebSocketMessage *message = new WebSocketMessage;
+        message->ids.push_back(id);
+        message->frame = NULL;
+
+        pushWebSocketMessage(message);
+    }
+
+    void Server::pushWebSocketMessage(WebSocketMessage *message)
+    {
+        WebSocketMessage *head;
+
+        do {
+            head = (WebSocketMessage *) outbound.get();
+            message->next = head;
+        } while (!outbound.compareAndSwap(head, message));
+
+        // The poll thread takes all the messages when it wakes up, only
+        // the first one has to wake it
+        if (head == NULL) {
+            post(NULL);
+        }
+    }
+
+    void Server::_flushWebSockets()
+    {
+        WebSocketMessage *message = (WebSocketMessage *) outbound.exchange(NULL);
+        WebSocketMessage *ordered = NULL;
+
+        // Back in the order they were sent
+        while (message != NULL) {
+            WebSocketMessage *next = message->next;
+            message->next = ordered;
+            ordered = message;
+            message = next;
+        }
+
+        vector<WebSocket *> scheduled, found;
+        while (ordered != NULL) {
+            message = ordered;
+            ordered = message->next;
+
+            // The websockets closed meanwhile are not found
+            websockets._getWebSockets(message->ids, found);
+
+            vector<WebSocket *>::iterator it;
+            for (it=found.begin(); it!=found.end(); it++) {
+                WebSocket *websocket = *it;
+
+                if (message->frame != NULL) {
+                    websocket->_queue(message->frame);
+                } else {
+                    websocket->_close();
+                }
+                if (websocket->_schedule()) {
+                    scheduled.push_back(websocket);
+                }
+            }
+
+            if (message->frame != NULL) {
+                message->frame->release();
+            }
+            delete message;
+        }
+
+        vector<WebSocket *>::iterator it;
+        for (it=scheduled.begin(); it!=scheduled.end(); it++) {
+            (*it)->_flush();
+        }
+    }
+
+    void Server::_webSocketFlush(struct mg_connection *conn)
+    {
+        WebSocket *websocket = (WebSocket *) conn->user_data;
+
+        if (websocket != NULL) {
+            websocket->_flush();
+        }
+    }
+
+    void Server::_webSocketClosed(struct mg_connection *conn)
+    {
+        WebSocket *websocket = (WebSocket *) conn->user_data;
+
+        if (websocket != NULL) {
+            conn->user_data = NULL;
+            websockets.remove(websocket);
+        }
+    }
 #endif
 
     bool Server::_handleRequest(struct mg_connection *connection, struct http_message *message)
     {
         Request request(connection, message);
 
+        // Its response would be written in the middle of the pending one
+        if (connection->flags & MG_F_PENDING_RESPONSE) {
+            pipelined[connection].push_back(request.detach());
+            connection->recv_mbuf_limit = 0;
+            return true;
+        }
+
         Response *response = handleRequest(request);
 
         if (response == NULL) {
             return false;
         } else {
             request.writeResponse(response);
-            delete response;
+
+            if (response->isComplete()) {
+                delete response;
+            } else {
+                responses[connection] = response;
+                connection->flags |= MG_F_PENDING_RESPONSE;
+            }
             return true;
         }
     }
 
+    void Server::post(ServerTask *task)
+    {
+        tasksMutex.lock();
+        if (task != NULL) {
+            tasks.push_back(task);
+        }
+        // One pending datagram is enough to wake the poll thread up
+        if (!wakeupPending && wakeupSockets[0] != INVALID_SOCKET) {
+            wakeupPending = true;
+            send(wakeupSockets[0], "", 1, 0);
+        }
+        tasksMutex.unlock();
+    }
+
+    void Server::_runTasks(struct mg_connection *)
+    {
+        vector<ServerTask *> current;
+
+        tasksMutex.lock();
+        wakeupPending = false;
+        current.swap(tasks);
+        tasksMutex.unlock();
+
+        vector<ServerTask *>::iterator it;
+        for (it = current.begin(); it != current.end(); it++) {
+            (*it)->run(this);
+            delete (*it);
+        }
+    }
+
+    struct mg_mgr *Server::_getManager()
+    {
+        return &mgr;
+    }
+
+    bool Server::_isStopped()
+    {
+        return stopped;
+    }
+
+    void Server::_pollResponse(struct mg_connection *connection)
+    {
+        map<struct mg_connection *, Response *>::iterator it = responses.find(connection);
+
+        if (it != responses.end()) {
+            Response *response = (*it).second;
+            response->poll(connection);
+
+            if (response->isComplete()) {
+                releaseResponse(connection);
+                handlePipelined(connection);
+            }
+        }
+    }
+
+    void Server::releaseResponse(struct mg_connection *connection)
+    {
+        map<struct mg_connection *, Response *>::iterator it = responses.find(connection);
+
+        if (it != responses.end()) {
+            delete (*it).second;
+            responses.erase(it);
+        }
+        connection->flags &= ~MG_F_PENDING_RESPONSE;
+    }
+
+    void Server::handlePipelined(struct mg_connection *connection)
+    {
+        map<struct mg_connection *, deque<Request *> >::iterator it = pipelined.find(connection);
+
+        if (it == pipelined.end()) {
+            return;
+        }
+
+        deque<Request *> &queue = (*it).second;
+        while (!queue.empty() && !(connection->flags & MG_F_PENDING_RESPONSE)) {
+            Request *request = queue.front();
+            queue.pop_front();
+
+            if (!_handleRequest(connection, request->_getMessage())) {
+                serve_static(connection, request->_getMessage());
+            }
+            delete request;
+        }
+
+        // Reading again once all of them are answered
+        if (queue.empty()) {
+            pipelined.erase(it);
+            connection->recv_mbuf_limit = connection->listener != NULL ? connection->listener->recv_mbuf_limit : ~0;
+        }
+    }
+
+    void Server::_closeResponse(struct mg_connection *connection)
+    {
+        releaseResponse(connection);
+
+        map<struct mg_connection *, deque<Request *> >::iterator it = pipelined.find(connection);
+        if (it != pipelined.end()) {
+            deque<Request *>::iterator rit;
+            for (rit=(*it).second.begin(); rit!=(*it).second.end(); rit++) {
+                delete (*rit);
+            }
+            pipelined.erase(it);
+        }
+    }
+
     bool Server::handles(string method, string url)
     {
 #ifndef NO_WEBSOCKET
@@ -224,31 +722,30 @@ namespace Mongoose
         }
 #endif
 
-        vector<Controller *>::iterator it;
-        for (it=controllers.begin(); it!=controllers.end(); it++) {
-            if ((*it)->handles(method, url)) {
-                return true;
-            }
-        }
-
-        return false;
+        return router.handles(method, url);
     }
 
     Response *Server::handleRequest(Request &request)
     {
-        Response *response;
-        vector<Controller *>::iterator it;
+        Router::Match match;
 
-        for (it=controllers.begin(); it!=controllers.end(); it++) {
-            Controller *controller = *it;
-            response = controller->process(request);
+        if (!router.find(request, match)) {
+            return NULL;
+        }
 
-            if (response != NULL) {
-                return response;
-            }
+        // The session is stored out of the process, the handler runs once
+        // it is loaded instead of blocking the poll thread
+        if (!sessions->_isLoaded(request)) {
+            ResponseHandle *handle = new ResponseHandle(this, NULL);
+            Request *detached = request.detach();
+
+            sessions->_load(*detached, new DispatchTask(this, match.controller, detached, handle));
+
+            return new AsyncResponse(handle);
         }
 
-        return NULL;
+        // process() finds the route on the request, it can be overridden
+        return match.controller->process(request);
     }
 
     void Server::setOption(string key, string value)
@@ -261,6 +758,28 @@ namespace Mongoose
     {
         return websockets;
     }
+
+    void Server::setWebSocketBackpressure(size_t highWatermark_, size_t lowWatermark_, WebSocket::Overflow overflow_)
+    {
+        highWatermark = highWatermark_;
+        lowWatermark = lowWatermark_ < highWatermark_ ? lowWatermark_ : highWatermark_;
+        overflow = overflow_;
+    }
+
+#ifdef ENABLE_WEBSOCKET_DEFLATE
+    void Server::setWebSocketDeflate(int windowBits, size_t threshold, bool contextTakeover)
+    {
+        if (windowBits < 9) {
+            windowBits = 9;
+        } else if (windowBits > 15) {
+            windowBits = 15;
+        }
+
+        deflateWindowBits = windowBits;
+        deflateThreshold = threshold;
+        deflateContextTakeover = contextTakeover;
+    }
+#endif
 #endif
 
 }
@@ -1,6 +1,8 @@
 #ifndef _MONGOOSE_SERVER_H
 #define _MONGOOSE_SERVER_H
 
+#include <map>
+#include <deque>
 #include <vector>
 #include <iostream>
 #include <mongoose.h>
@@ -13,6 +15,8 @@
 #endif
 #include "Mutex.h"
 #include "Sessions.h"
+#include "Executor.h"
+#include "Router.h"
 
 using namespace std;
 
@@ -37,6 +41,24 @@ namespace Mongoose
 		}
 	};
 
+    class Server;
+
+    /**
+     * A task to run on the poll thread, see Server::post()
+     */
+    class ServerTask
+    {
+        public:
+            virtual ~ServerTask() {}
+
+            /**
+             * Runs the task, this is called on the poll thread
+             *
+             * @param Server* the server
+             */
+            virtual void run(Server *server)=0;
+    };
+
     class Server
     {
         public:
@@ -59,6 +81,61 @@ namespace Mongoose
              */
             void stop();
 
+            /**
+             * Sets the number of worker threads running the controllers, this
+             * has to be called before start(). With 0 (the default) the
+             * controllers run on the poll thread
+             *
+             * @param int the number of workers
+             */
+            void setWorkers(int workers);
+
+            /**
+             * Gets the executor running the controllers
+             *
+             * @return Executor* the executor, or NULL if there is no workers
+             */
+            Executor *getExecutor();
+
+            /**
+             * Keeps the sessions in a snapshot file, so that they survive
+             * restarts. The sessions of the file are loaded now, then it is
+             * written periodically in the background and when the server
+             * stops. This has to be called after setSessions()
+             *
+             * @param string the path of the snapshot file
+             * @param int the time between two snapshots, in seconds
+             */
+            void setSnapshot(string path, int interval = 60);
+
+            /**
+             * Internally used to write a snapshot in the background
+             */
+            void _snapshot();
+
+            /**
+             * Sets the sessions used by the controllers, for instance to
+             * keep them in signed cookies with CookieSessions. The server
+             * does not take ownership of it
+             *
+             * @param Sessions* the sessions
+             */
+            void setSessions(Sessions *sessions);
+
+            /**
+             * Gets the sessions used by the controllers
+             *
+             * @return Sessions the sessions
+             */
+            Sessions &getSessions();
+
+            /**
+             * Gets the routes of all the controllers
+             *
+             * @return Router the router
+             */
+            Router &getRouter();
+
             /**
              * Register a new controller on the server
              *
@@ -73,6 +150,54 @@ namespace Mongoose
              */
             bool _handleRequest(struct mg_connection *connection, struct http_message *message);
 
+            /**
+             * Runs the given task on the poll thread, this can be called from
+             * any thread. The server takes the ownership of the task
+             *
+             * @param ServerTask* the task to run
+             */
+            void post(ServerTask *task);
+
+            /**
+             * Internally used to run the posted tasks when the poll thread
+             * is woken up
+             *
+             * @param struct mg_connection* the wakeup connection
+             */
+            void _runTasks(struct mg_connection *connection);
+
+            /**
+             * Internally used by the components making their own
+             * connections on the poll thread, like RedisSessions
+             *
+             * @return struct mg_mgr* the mongoose manager
+             */
+            struct mg_mgr *_getManager();
+
+            /**
+             * Internally used by the tasks dropped without running, they
+             * don't answer once the server is stopped
+             *
+             * @return bool true if the server is stopped
+             */
+            bool _isStopped();
+
+            /**
+             * Internally used to continue writing an incomplete response when
+             * its connection can take more data
+             *
+             * @param struct mg_connection* the mongoose connection
+             */
+            void _pollResponse(struct mg_connection *connection);
+
+            /**
+             * Internally used to release the incomplete response of a closed
+             * connection, and the requests waiting for it
+             *
+             * @param struct mg_connection* the mongoose connection
+             */
+            void _closeResponse(struct mg_connection *connection);
+
             /**
              * Internally used to process a file upload
              *
@@ -81,6 +206,15 @@ namespace Mongoose
              */
             void _upload(struct mg_connection *conn, const char *fileName);
 
+#ifndef NO_WEBSOCKET
+            /**
+             * Creates the websocket of a connection being upgraded
+             *
+             * @param struct mg_connection* the mongoose connection with the client
+             * @param struct http_message* the handshake request
+             */
+            void _webSocketHandshake(struct mg_connection *conn, struct http_message *message);
+
             /**
              * Handles a web socket connection
              *
@@ -92,13 +226,52 @@ namespace Mongoose
              * Handles web sockets data
              *
              * @param struct mg_connection* the mongoose connection
-             * @param int flags the data flags
-             * @param char* the data
-             * @param size the data size
+             * @param mg_str the data, in the receive buffer
+             * @param int the flags of the frame
              *
              * @return int if we have to keep the connection opened
              */
-            int _webSocketData(struct mg_connection *conn, string data);
+            int _webSocketData(struct mg_connection *conn, struct mg_str data, int flags = 0);
+
+            /**
+             * Sends a frame to websockets from any thread, the poll thread
+             * queues it on their connections
+             *
+             * @param vector<int> the ids of the websockets
+             * @param WebSocketFrame* the frame, a reference is taken
+             */
+            void _webSocketSend(const vector<int> &ids, WebSocketFrame *frame);
+
+            /**
+             * Closes a websocket from any thread, once the frames sent
+             * before are written
+             *
+             * @param int the id of the websocket
+             */
+            void _webSocketClose(int id);
+
+            /**
+             * Internally used to queue the frames and the closes sent from any
+             * thread on their websockets, each websocket is flushed once for
+             * all of them. This is called on the poll thread
+             */
+            void _flushWebSockets();
+
+            /**
+             * Internally used to write the queued frames of a websocket as
+             * its connection drains
+             *
+             * @param struct mg_connection* the mongoose connection
+             */
+            void _webSocketFlush(struct mg_connection *conn);
+
+            /**
+             * Internally used to release the websocket of a closed connection
+             *
+             * @param struct mg_connection* the mongoose connection
+             */
+            void _webSocketClosed(struct mg_connection *conn);
+#endif
 
             /**
              * Process the request by controllers
@@ -133,6 +306,34 @@ namespace Mongoose
              * @return WebSockets the web sockets container
              */
             WebSockets &getWebSockets();
+
+            /**
+             * Sets how much can wait to be sent to each websocket, and what
+             * is done with the messages beyond that, for the websockets
+             * connected afterward
+             *
+             * @param size_t the bytes waiting over which the policy applies,
+             *               0 to never apply it
+             * @param size_t the bytes waiting under which it stops applying
+             * @param WebSocket::Overflow the policy
+             */
+            void setWebSocketBackpressure(size_t highWatermark = WEBSOCKET_HIGH_WATERMARK,
+                    size_t lowWatermark = WEBSOCKET_LOW_WATERMARK,
+                    WebSocket::Overflow overflow = WebSocket::OVERFLOW_DISCONNECT);
+
+#ifdef ENABLE_WEBSOCKET_DEFLATE
+            /**
+             * Compresses the messages of the websockets whose client supports
+             * the permessage-deflate extension
+             *
+             * @param int the largest compression window, from 9 to 15 bits
+             * @param size_t the size under which the messages are sent as is
+             * @param bool whether the contexts are kept between messages,
+             *             compressing better at the cost of memory on each
+             *             connection
+             */
+            void setWebSocketDeflate(int windowBits = 15, size_t threshold = 256, bool contextTakeover = true);
+#endif
 #endif
 
             /**
@@ -156,16 +357,85 @@ namespace Mongoose
 			struct mg_mgr mgr;
             volatile bool stopped;
             volatile bool destroyed;
-            Sessions sessions;
+            Sessions defaultSessions;
+            Sessions *sessions;
             //Mutex mutex;
             map<string, string> optionsMap;
+            map<struct mg_connection *, Response *> responses;
+
+            // Requests pipelined behind an incomplete response, answered
+            // in order once it is, the connection is not read meanwhile
+            map<struct mg_connection *, deque<Request *> > pipelined;
+
+            /**
+             * Releases the response of a connection once it is complete
+             *
+             * @param struct mg_connection* the mongoose connection
+             */
+            void releaseResponse(struct mg_connection *connection);
+
+            /**
+             * Answers the requests pipelined behind a response that is now
+             * complete, until one of them is not
+             *
+             * @param struct mg_connection* the mongoose connection
+             */
+            void handlePipelined(struct mg_connection *connection);
+
+            // Posted tasks, and the socket pair waking up the poll thread
+            Mutex tasksMutex;
+            vector<ServerTask *> tasks;
+            bool wakeupPending;
+            sock_t wakeupSockets[2];
             struct mg_connection *server_connection;
 
+            int workers;
+            Executor *executor;
+
+            string snapshotPath;
+            int snapshotInterval;
+            volatile bool snapshotRunning;
+            time_t snapshotted;
+
 #ifndef NO_WEBSOCKET
+            /**
+             * A frame to send to websockets, or a close if it has none
+             */
+            struct WebSocketMessage
+            {
+                vector<int> ids;
+                WebSocketFrame *frame;
+                WebSocketMessage *next;
+            };
+
+            /**
+             * Pushes a message for the poll thread, without locking
+             *
+             * @param WebSocketMessage* the message
+             */
+            void pushWebSocketMessage(WebSocketMessage *message);
+
             WebSockets websockets;
+
+            // Messages pushed by any thread, latest first, that the poll
+            // thread takes all at once
+            AtomicPointer outbound;
+
+            // The backpressure of the new websockets
+            size_t highWatermark;
+            size_t lowWatermark;
+            WebSocket::Overflow overflow;
+
+#ifdef ENABLE_WEBSOCKET_DEFLATE
+            // 0 if the compression is disabled
+            int deflateWindowBits;
+            size_t deflateThreshold;
+            bool deflateContextTakeover;
+#endif
 #endif
 
             vector<Controller *> controllers;
+            Router router;
     };
 }
 
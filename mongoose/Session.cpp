@@ -7,11 +7,131 @@ using namespace std;
 
 namespace Mongoose
 {
+    SessionValues::SessionValues()
+        : references(1)
+    {
+    }
+
+    SessionValues::SessionValues(const SessionValues &other)
+        : values(other.values), references(1)
+    {
+    }
+
+    SessionValues::~SessionValues()
+    {
+    }
+
+    void SessionValues::acquire()
+    {
+        references.increment();
+    }
+
+    void SessionValues::release()
+    {
+        if (references.decrement() == 0) {
+            delete this;
+        }
+    }
+
+    Session::Snapshot::Snapshot(SessionValues *values_)
+        : values(values_)
+    {
+    }
+
+    Session::Snapshot::Snapshot(const Snapshot &other)
+        : values(other.values)
+    {
+        if (values != NULL) {
+            values->acquire();
+        }
+    }
+
+    Session::Snapshot &Session::Snapshot::operator=(const Snapshot &other)
+    {
+        if (other.values != NULL) {
+            other.values->acquire();
+        }
+        if (values != NULL) {
+            values->release();
+        }
+        values = other.values;
+
+        return *this;
+    }
+
+    Session::Snapshot::~Snapshot()
+    {
+        if (values != NULL) {
+            values->release();
+        }
+    }
+
+    bool Session::Snapshot::has(const string &key) const
+    {
+        return values != NULL && values->values.find(key) != values->values.end();
+    }
+
+    bool Session::Snapshot::get(const string &key, struct mg_str &value) const
+    {
+        if (values != NULL) {
+            map<string, string>::const_iterator it = values->values.find(key);
+
+            if (it != values->values.end()) {
+                value.p = (*it).second.data();
+                value.len = (*it).second.size();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    string Session::Snapshot::get(const string &key, string fallback) const
+    {
+        struct mg_str value;
+
+        if (get(key, value)) {
+            return string(value.p, value.len);
+        }
+
+        return fallback;
+    }
+
+    const map<string, string> &Session::Snapshot::getValues() const
+    {
+        static const map<string, string> empty;
+
+        return values != NULL ? values->values : empty;
+    }
+
+    void Session::Update::set(const string &key, const string &value)
+    {
+        Change change;
+        change.key = key;
+        change.value = value;
+        change.unset = false;
+        changes.push_back(change);
+    }
+
+    void Session::Update::unset(const string &key)
+    {
+        Change change;
+        change.key = key;
+        change.unset = true;
+        changes.push_back(change);
+    }
+
     Session::Session()
+        : values(new SessionValues())
     {
         ping();
     }
 
+    Session::~Session()
+    {
+        values->release();
+    }
+
     void Session::ping()
     {
         mutex.lock();
@@ -19,37 +139,81 @@ namespace Mongoose
         mutex.unlock();
     }
 
-    void Session::setValue(string key, string value)
+    Session::Snapshot Session::getSnapshot()
     {
+        // Only taking a reference is done under the lock
         mutex.lock();
-        values[key] = value;
+        SessionValues *current = values;
+        current->acquire();
         mutex.unlock();
+
+        return Snapshot(current);
     }
 
-    void Session::unsetValue(string key)
+    void Session::publish(SessionValues *values_)
     {
         mutex.lock();
-        values.erase(key);
+        SessionValues *previous = values;
+        values = values_;
         mutex.unlock();
+
+        previous->release();
     }
 
-    bool Session::hasValue(string key)
+    void Session::swap(SessionValues *values_)
     {
-        return values.find(key) != values.end();
+        writeMutex.lock();
+        publish(values_);
+        writeMutex.unlock();
     }
 
-    string Session::get(string key, string fallback)
+    void Session::apply(const Update &update)
     {
-        mutex.lock();
-        if (hasValue(key)) {
-            string value = values[key];
-            mutex.unlock();
+        // The writers are serialized, so that none of their changes is lost,
+        // the readers keep using the previous values meanwhile
+        writeMutex.lock();
+        change(update);
+        writeMutex.unlock();
+    }
 
-            return value;
-        } else {
-            mutex.unlock();
-            return fallback;
+    void Session::change(const Update &update)
+    {
+        SessionValues *copy = new SessionValues(*values);
+
+        vector<Update::Change>::const_iterator it;
+        for (it=update.changes.begin(); it!=update.changes.end(); it++) {
+            if ((*it).unset) {
+                copy->values.erase((*it).key);
+            } else {
+                copy->values[(*it).key] = (*it).value;
+            }
         }
+
+        publish(copy);
+    }
+
+    void Session::setValue(string key, string value)
+    {
+        Update update;
+        update.set(key, value);
+        apply(update);
+    }
+
+    void Session::unsetValue(string key)
+    {
+        Update update;
+        update.unset(key);
+        apply(update);
+    }
+
+    bool Session::hasValue(string key)
+    {
+        return getSnapshot().has(key);
+    }
+
+    string Session::get(string key, string fallback)
+    {
+        return getSnapshot().get(key, fallback);
     }
 
     int Session::getAge()
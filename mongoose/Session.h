@@ -2,19 +2,148 @@
 #define _MONGOOSE_SESSION_H
 
 #include <map>
+#include <vector>
+#include <string>
+#include <mongoose.h>
 #include "Mutex.h"
 
 using namespace std;
 
 /**
  * A session contains the user specific values
- */ 
+ *
+ * The values are kept in an immutable, reference counted, snapshot. A
+ * writer copies the snapshot, changes the copy and swaps it in, while the
+ * readers go on with the snapshot they hold: reading never copies the
+ * values and never waits for a writer.
+ */
 namespace Mongoose
 {
+    /**
+     * Values of a session at some point, never modified once published
+     */
+    class SessionValues
+    {
+        public:
+            SessionValues();
+            SessionValues(const SessionValues &other);
+
+            void acquire();
+            void release();
+
+            map<string, string> values;
+
+        protected:
+            virtual ~SessionValues();
+
+            AtomicCounter references;
+
+        private:
+            SessionValues &operator=(const SessionValues &);
+    };
+
     class Session
     {
         public:
+            /**
+             * A read-only view of the session values, valid as long as it is
+             * held whatever the writers do
+             */
+            class Snapshot
+            {
+                public:
+                    Snapshot(SessionValues *values = NULL);
+                    Snapshot(const Snapshot &other);
+                    Snapshot &operator=(const Snapshot &other);
+                    virtual ~Snapshot();
+
+                    /**
+                     * Check if the given variable exists
+                     *
+                     * @param string the name of the variable
+                     */
+                    bool has(const string &key) const;
+
+                    /**
+                     * Gets a view of a value, the view is valid as long as
+                     * the snapshot
+                     *
+                     * @param string the name of the variable
+                     * @param struct mg_str the view to fill
+                     *
+                     * @return bool true if the variable exists
+                     */
+                    bool get(const string &key, struct mg_str &value) const;
+
+                    /**
+                     * Try to get the value for the given variable
+                     *
+                     * @param string the name of the variable
+                     * @param string the fallback value
+                     *
+                     * @return string the value of the variable if it exists, fallback else
+                     */
+                    string get(const string &key, string fallback = "") const;
+
+                    /**
+                     * Gets all the values
+                     *
+                     * @return map the values
+                     */
+                    const map<string, string> &getValues() const;
+
+                protected:
+                    SessionValues *values;
+            };
+
+            /**
+             * Changes to apply to a session at once, with a single copy of
+             * its values
+             */
+            class Update
+            {
+                public:
+                    /**
+                     * Sets the value of a session variable
+                     *
+                     * @param string the name of the variable
+                     * @param string the value of the variable
+                     */
+                    void set(const string &key, const string &value);
+
+                    /**
+                     * Unset a session variable
+                     *
+                     * @param string the variable name
+                     */
+                    void unset(const string &key);
+
+                    struct Change
+                    {
+                        string key;
+                        string value;
+                        bool unset;
+                    };
+
+                    vector<Change> changes;
+            };
+
             Session();
+            virtual ~Session();
+
+            /**
+             * Gets the current values of the session
+             *
+             * @return Snapshot the values
+             */
+            virtual Snapshot getSnapshot();
+
+            /**
+             * Applies changes to the session values
+             *
+             * @param Update the changes
+             */
+            virtual void apply(const Update &update);
 
             /**
              * Sets the value of a session variable
@@ -22,21 +151,21 @@ namespace Mongoose
              * @param string the name of the variable
              * @param string the value of the variable
              */
-            void setValue(string key, string value);
+            virtual void setValue(string key, string value);
 
             /**
              * Unset a session varaible
              *
              * @param string the variable name
              */
-            void unsetValue(string key);
+            virtual void unsetValue(string key);
 
             /**
              * Check if the given variable exists
              *
              * @param string the name of the variable
              */
-            bool hasValue(string key);
+            virtual bool hasValue(string key);
 
             /**
              * Try to get the value for the given variable
@@ -46,25 +175,55 @@ namespace Mongoose
              *
              * @return string the value of the variable if it exists, fallback else
              */
-            string get(string key, string fallback = "");
+            virtual string get(string key, string fallback = "");
 
             /**
              * Pings the session, this will update the creation date to now
              * and "keeping it alive"
              */
-            void ping();
+            virtual void ping();
 
             /**
              * Returns the session age, in seconds
              *
              * @return int the number of sessions since the last activity of the session
              */
-            int getAge();
+            virtual int getAge();
 
         protected:
-            map<string, string> values;
+            // The sessions restore the values and the date from snapshots
+            friend class Sessions;
+
+            /**
+             * Replaces the values, the session takes the reference
+             *
+             * @param SessionValues* the new values
+             */
+            void swap(SessionValues *values);
+
+            /**
+             * Publishes new values, the write mutex must be held
+             */
+            void publish(SessionValues *values);
+
+            /**
+             * Publishes a copy of the values with the changes applied, the
+             * write mutex must be held
+             *
+             * @param Update the changes
+             */
+            void change(const Update &update);
+
+            // Swapped under both mutexes, the readers only take the first
+            // one to get a reference, and the writers hold the second one
+            SessionValues *values;
             int date;
             Mutex mutex;
+            Mutex writeMutex;
+
+        private:
+            Session(const Session &);
+            Session &operator=(const Session &);
     };
 }
 
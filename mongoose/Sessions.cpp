@@ -1,83 +1,585 @@
 #include <vector>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <iostream>
+#ifndef _MSC_VER
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 #include "Sessions.h"
+#include "Server.h"
 
 using namespace std;
 
+/**
+ * Snapshot files start with the magic, the version, a byte order mark and
+ * the number of sessions. Each session follows with its id, last use and
+ * ping dates, and values, the sizes being 32 bits and the dates 64 bits
+ */
+#define SNAPSHOT_MAGIC "MGSESS\0\0"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_BYTE_ORDER 0x01020304
+#define SNAPSHOT_HEADER_SIZE 24
+
+static void appendSize(vector<char> &buffer, size_t size)
+{
+    unsigned int value = size;
+    const char *bytes = (const char *) &value;
+
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(value));
+}
+
+static void appendDate(vector<char> &buffer, long long date)
+{
+    const char *bytes = (const char *) &date;
+
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(date));
+}
+
+static void appendString(vector<char> &buffer, const string &value)
+{
+    appendSize(buffer, value.size());
+    buffer.insert(buffer.end(), value.begin(), value.end());
+}
+
+/**
+ * Reads a snapshot, checking that nothing is read past its end
+ */
+class SnapshotReader
+{
+    public:
+        SnapshotReader(const char *data_, size_t size)
+            : data(data_), end(data_ + size)
+        {
+        }
+
+        bool read(void *value, size_t size)
+        {
+            if ((size_t) (end - data) < size) {
+                return false;
+            }
+            memcpy(value, data, size);
+            data += size;
+
+            return true;
+        }
+
+        const char *position()
+        {
+            return data;
+        }
+
+        bool readString(const char *&value, unsigned int &size)
+        {
+            if (!read(&size, sizeof(size)) || (size_t) (end - data) < size) {
+                return false;
+            }
+            value = data;
+            data += size;
+
+            return true;
+        }
+
+    protected:
+        const char *data;
+        const char *end;
+};
+
 static char charset[] = "abcdeghijklmnpqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
-#define CHARSET_SIZE (sizeof(charset)/sizeof(char))
+#define CHARSET_SIZE (sizeof(charset)/sizeof(char) - 1)
+#define SESSION_ID_SIZE 30
 
 namespace Mongoose
 {
     Sessions::Sessions(string key_) 
-        : sessions(), key(key_)
+        : key(key_)
     {
     }
 	
 	Sessions::~Sessions()
 	{
-		map<string, Session *>::iterator it;
-		for (it=sessions.begin(); it!=sessions.end(); it++) {
-			delete (*it).second;
-		}
+        for (int i = 0; i < SESSIONS_SHARDS; i++) {
+            Entry *entry = shards[i].oldest;
+
+            while (entry != NULL) {
+                Entry *next = entry->newer;
+                if (entry->session != NULL) {
+                    delete entry->session;
+                }
+                delete entry;
+                entry = next;
+            }
+        }
+
+        vector<Snapshot>::iterator it;
+        for (it=snapshots.begin(); it!=snapshots.end(); it++) {
+            release(*it);
+        }
 	}
 
+    void Sessions::release(Snapshot &snapshot)
+    {
+#ifndef _MSC_VER
+        munmap(snapshot.data, snapshot.size);
+#else
+        free(snapshot.data);
+#endif
+    }
+
+    size_t Sessions::hash(const char *data, size_t size)
+    {
+        // FNV-1a
+        size_t value = 2166136261u;
+
+        for (size_t i = 0; i < size; i++) {
+            value = (value ^ (unsigned char) data[i]) * 16777619u;
+        }
+
+        return value;
+    }
+
     string Sessions::getId(Request &request, Response &response)
     {
-		std::string curr = request.getCookie(key);
-		if (!curr.empty()) {
-			return curr;
-		}
-        ostringstream newCookie;
-        int i;
+        struct mg_str cookie;
 
-        for (i=0; i<30; i++) {
-            newCookie << charset[rand()%CHARSET_SIZE];
+        if (request.getCookie(key, cookie) && cookie.len > 0) {
+            return string(cookie.p, cookie.len);
         }
 
-        response.setCookie(key, newCookie.str());
+        string newCookie = generateId();
+        response.setCookie(key, newCookie);
+
+        return newCookie;
+    }
+
+    string Sessions::generateId()
+    {
+        char id[SESSION_ID_SIZE];
+        for (int i = 0; i < SESSION_ID_SIZE; i++) {
+            id[i] = charset[rand()%CHARSET_SIZE];
+        }
 
-        return newCookie.str();
+        return string(id, sizeof(id));
     }
 
     Session &Sessions::get(Request &request, Response &response)
     { 
+        struct mg_str cookie;
+
+        // Known sessions are found without copying the id
+        if (request.getCookie(key, cookie) && cookie.len > 0) {
+            return *lookup(cookie.p, cookie.len);
+        }
+
         string id = getId(request, response);
-		Session *session = NULL;
-        
-        mutex.lock();
-		if (sessions.find(id) != sessions.end()) {
-			session = sessions[id];
-		} else {
-			session = new Session();
-			sessions[id] = session;
-		}
-        mutex.unlock();
 
-        return *session;
+        return *lookup(id.data(), id.size());
+    }
+
+    Session *Sessions::createSession(const char *, size_t)
+    {
+        return new Session();
+    }
+
+    bool Sessions::_isLoaded(Request &)
+    {
+        return true;
+    }
+
+    void Sessions::_load(Request &, ServerTask *task)
+    {
+        // Nothing to load, this is not called
+        delete task;
+    }
+
+    Session *Sessions::lookup(const char *id, size_t size)
+    {
+        size_t value = hash(id, size);
+        Shard &shard = shards[value % SESSIONS_SHARDS];
+
+        shard.mutex.lock();
+        Entry *entry = find(shard, value, id, size);
+
+        if (entry == NULL) {
+            entry = insert(shard, value, id, size);
+            entry->session = createSession(id, size);
+        } else {
+            unlink(shard, entry);
+        }
+        touch(shard, entry, time(NULL));
+
+        if (entry->session == NULL) {
+            restore(entry);
+        }
+        Session *session = entry->session;
+        shard.mutex.unlock();
+
+        return session;
+    }
+
+    Sessions::Entry *Sessions::find(Shard &shard, size_t value, const char *id, size_t size)
+    {
+        if (shard.buckets.empty()) {
+            return NULL;
+        }
+
+        Entry *entry = shard.buckets[(value / SESSIONS_SHARDS) % shard.buckets.size()];
+        while (entry != NULL && !(entry->hash == value && entry->id.size() == size &&
+                    memcmp(entry->id.data(), id, size) == 0)) {
+            entry = entry->next;
+        }
+
+        return entry;
+    }
+
+    Sessions::Entry *Sessions::insert(Shard &shard, size_t value, const char *id, size_t size)
+    {
+        if (shard.buckets.empty()) {
+            shard.buckets.resize(16, NULL);
+        } else if (shard.count >= shard.buckets.size()) {
+            grow(shard);
+        }
+
+        Entry *entry = new Entry;
+        entry->id.assign(id, size);
+        entry->hash = value;
+        entry->session = NULL;
+        entry->record = NULL;
+        entry->recordSize = 0;
+        entry->older = entry->newer = NULL;
+
+        Entry *&bucket = shard.buckets[(value / SESSIONS_SHARDS) % shard.buckets.size()];
+        entry->next = bucket;
+        bucket = entry;
+        shard.count++;
+
+        return entry;
+    }
+
+    void Sessions::restore(Entry *entry)
+    {
+        // The record was checked when the snapshot was loaded
+        const char *data = entry->record;
+        long long date;
+        unsigned int values, keySize, valueSize;
+        Session *session = createSession(entry->id.data(), entry->id.size());
+
+        memcpy(&date, data, sizeof(date));
+        memcpy(&values, data + sizeof(date), sizeof(values));
+        data += sizeof(date) + sizeof(values);
+
+        SessionValues *restored = new SessionValues();
+        session->date = date;
+        for (unsigned int i = 0; i < values; i++) {
+            memcpy(&keySize, data, sizeof(keySize));
+            const char *key = data + sizeof(keySize);
+            data = key + keySize;
+            memcpy(&valueSize, data, sizeof(valueSize));
+            const char *value = data + sizeof(valueSize);
+            data = value + valueSize;
+
+            restored->values[string(key, keySize)] = string(value, valueSize);
+        }
+        session->swap(restored);
+
+        entry->session = session;
+        entry->record = NULL;
+    }
+
+    int Sessions::getAge(Entry *entry)
+    {
+        if (entry->session != NULL) {
+            return entry->session->getAge();
+        }
+
+        long long date;
+        memcpy(&date, entry->record, sizeof(date));
+
+        return time(NULL) - date;
+    }
+
+    void Sessions::unlink(Shard &shard, Entry *entry)
+    {
+        if (entry->older != NULL) {
+            entry->older->newer = entry->newer;
+        } else {
+            shard.oldest = entry->newer;
+        }
+        if (entry->newer != NULL) {
+            entry->newer->older = entry->older;
+        } else {
+            shard.newest = entry->older;
+        }
+        entry->older = entry->newer = NULL;
+    }
+
+    void Sessions::touch(Shard &shard, Entry *entry, time_t now)
+    {
+        entry->used = now;
+        entry->older = shard.newest;
+        entry->newer = NULL;
+        if (shard.newest != NULL) {
+            shard.newest->newer = entry;
+        } else {
+            shard.oldest = entry;
+        }
+        shard.newest = entry;
+    }
+
+    void Sessions::grow(Shard &shard)
+    {
+        vector<Entry *> buckets(shard.buckets.size() * 2, (Entry *) NULL);
+
+        vector<Entry *>::iterator it;
+        for (it = shard.buckets.begin(); it != shard.buckets.end(); it++) {
+            Entry *entry = *it;
+
+            while (entry != NULL) {
+                Entry *next = entry->next;
+                Entry *&bucket = buckets[(entry->hash / SESSIONS_SHARDS) % buckets.size()];
+                entry->next = bucket;
+                bucket = entry;
+                entry = next;
+            }
+        }
+
+        shard.buckets.swap(buckets);
     }
 
     void Sessions::garbageCollect(int oldAge)
     {
-        vector<string> deleteList;
-        map<string, Session*>::iterator it;
-        vector<string>::iterator vit;
+        time_t now = time(NULL);
+
+        for (int i = 0; i < SESSIONS_SHARDS; i++) {
+            Shard &shard = shards[i];
+
+            shard.mutex.lock();
+            while (shard.oldest != NULL && now - shard.oldest->used > oldAge) {
+                Entry *entry = shard.oldest;
+                int age = getAge(entry);
+
+                unlink(shard, entry);
+
+                // Pinged since it was last looked up, it goes back in the list
+                if (age <= oldAge) {
+                    touch(shard, entry, now - age);
+                    continue;
+                }
+
+                Entry **link = &shard.buckets[(entry->hash / SESSIONS_SHARDS) % shard.buckets.size()];
+                while (*link != entry) {
+                    link = &(*link)->next;
+                }
+                *link = entry->next;
+                shard.count--;
+
+                if (entry->session != NULL) {
+                    delete entry->session;
+                }
+                delete entry;
+            }
+            shard.mutex.unlock();
+        }
+    }
+
+    bool Sessions::save(string path)
+    {
+        string temporary = path + ".tmp";
+        FILE *file = fopen(temporary.c_str(), "wb");
+
+        if (file == NULL) {
+            return false;
+        }
+
+        vector<char> buffer;
+        buffer.insert(buffer.end(), SNAPSHOT_MAGIC, SNAPSHOT_MAGIC + 8);
+        appendSize(buffer, SNAPSHOT_VERSION);
+        appendSize(buffer, SNAPSHOT_BYTE_ORDER);
+        appendDate(buffer, 0);
+
+        bool written = fwrite(&buffer[0], 1, buffer.size(), file) == buffer.size();
+        long long count = 0;
+
+        // Each shard is copied under its lock and written after, the
+        // sessions go from the oldest to the newest so that loading
+        // them rebuilds the same order
+        for (int i = 0; i < SESSIONS_SHARDS && written; i++) {
+            Shard &shard = shards[i];
+
+            buffer.clear();
+            shard.mutex.lock();
+            for (Entry *entry = shard.oldest; entry != NULL; entry = entry->newer) {
+                Session *session = entry->session;
+
+                appendString(buffer, entry->id);
+                appendDate(buffer, entry->used);
+
+                // Not used since it was loaded, it is still in its record
+                if (session == NULL) {
+                    buffer.insert(buffer.end(), entry->record, entry->record + entry->recordSize);
+                    continue;
+                }
+
+                Session::Snapshot snapshot = session->getSnapshot();
+                const map<string, string> &values = snapshot.getValues();
+
+                appendDate(buffer, session->date);
+                appendSize(buffer, values.size());
+
+                map<string, string>::const_iterator it;
+                for (it=values.begin(); it!=values.end(); it++) {
+                    appendString(buffer, it->first);
+                    appendString(buffer, it->second);
+                }
+            }
+            count += shard.count;
+            shard.mutex.unlock();
+
+            if (!buffer.empty()) {
+                written = fwrite(&buffer[0], 1, buffer.size(), file) == buffer.size();
+            }
+        }
+
+        // The number of sessions is known at the end
+        written = written && fseek(file, SNAPSHOT_HEADER_SIZE - sizeof(count), SEEK_SET) == 0 &&
+            fwrite(&count, sizeof(count), 1, file) == 1;
+        written = (fclose(file) == 0) && written;
+
+        if (!written) {
+            remove(temporary.c_str());
+            return false;
+        }
+
+#ifdef _MSC_VER
+        remove(path.c_str());
+#endif
+        return rename(temporary.c_str(), path.c_str()) == 0;
+    }
+
+    bool Sessions::load(string path)
+    {
+        Snapshot snapshot;
+
+#ifndef _MSC_VER
+        // The snapshot stays mapped, the sessions are only rebuilt from it
+        // when they are used
+        int descriptor = open(path.c_str(), O_RDONLY);
+        struct stat status;
+
+        if (descriptor < 0) {
+            return false;
+        }
+        if (fstat(descriptor, &status) != 0 || status.st_size < SNAPSHOT_HEADER_SIZE) {
+            close(descriptor);
+            return false;
+        }
+        snapshot.size = status.st_size;
+        snapshot.data = mmap(NULL, snapshot.size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        close(descriptor);
+        if (snapshot.data == MAP_FAILED) {
+            return false;
+        }
+        madvise(snapshot.data, snapshot.size, MADV_SEQUENTIAL);
+#else
+        FILE *file = fopen(path.c_str(), "rb");
+
+        if (file == NULL) {
+            return false;
+        }
+        fseek(file, 0, SEEK_END);
+        snapshot.size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        snapshot.data = malloc(snapshot.size);
+        if (snapshot.size < SNAPSHOT_HEADER_SIZE || snapshot.data == NULL ||
+                fread(snapshot.data, 1, snapshot.size, file) != snapshot.size) {
+            free(snapshot.data);
+            fclose(file);
+            return false;
+        }
+        fclose(file);
+#endif
 
-        mutex.lock();
-        for (it=sessions.begin(); it!=sessions.end(); it++) {
-            string name = (*it).first;
-            Session *session = (*it).second;
+        SnapshotReader reader((const char *) snapshot.data, snapshot.size);
+        char magic[8];
+        unsigned int version, byteOrder;
+        long long count;
+        bool loaded = reader.read(magic, sizeof(magic)) && memcmp(magic, SNAPSHOT_MAGIC, 8) == 0 &&
+            reader.read(&version, sizeof(version)) && version == SNAPSHOT_VERSION &&
+            reader.read(&byteOrder, sizeof(byteOrder)) && byteOrder == SNAPSHOT_BYTE_ORDER &&
+            reader.read(&count, sizeof(count)) && count >= 0;
 
-            if (session->getAge() > oldAge) {
-				delete session;
-                deleteList.push_back(name);
+        if (loaded) {
+            // The tables are sized once instead of growing while loading
+            size_t buckets = 16;
+            while (buckets * SESSIONS_SHARDS < (size_t) count) {
+                buckets *= 2;
+            }
+            for (int i = 0; i < SESSIONS_SHARDS; i++) {
+                shards[i].mutex.lock();
+                if (shards[i].count == 0) {
+                    shards[i].buckets.assign(buckets, (Entry *) NULL);
+                }
+                shards[i].mutex.unlock();
             }
         }
 
-        for (vit=deleteList.begin(); vit!=deleteList.end(); vit++) {
-            sessions.erase(*vit);
+        // Only the index is built, each record is checked but its values
+        // are left in the snapshot
+        long long indexed = 0;
+        for (long long i = 0; loaded && i < count; i++) {
+            const char *id, *record, *key, *value;
+            unsigned int idSize, keySize, valueSize, values;
+            long long used, date;
+
+            loaded = reader.readString(id, idSize) && idSize > 0 &&
+                reader.read(&used, sizeof(used));
+            record = reader.position();
+            loaded = loaded && reader.read(&date, sizeof(date)) && reader.read(&values, sizeof(values));
+            for (unsigned int j = 0; loaded && j < values; j++) {
+                loaded = reader.readString(key, keySize) && reader.readString(value, valueSize);
+            }
+            if (!loaded) {
+                break;
+            }
+
+            size_t hashValue = hash(id, idSize);
+            Shard &shard = shards[hashValue % SESSIONS_SHARDS];
+
+            // The sessions already there are more recent
+            shard.mutex.lock();
+            if (find(shard, hashValue, id, idSize) == NULL) {
+                Entry *entry = insert(shard, hashValue, id, idSize);
+                entry->record = record;
+                entry->recordSize = reader.position() - record;
+                touch(shard, entry, used);
+                indexed++;
+            }
+            shard.mutex.unlock();
+        }
+
+        // The records of the sessions loaded before an error stay valid
+        if (indexed > 0) {
+            snapshots.push_back(snapshot);
+        } else {
+            release(snapshot);
+        }
+
+        return loaded;
+    }
+
+    size_t Sessions::size()
+    {
+        size_t count = 0;
+
+        for (int i = 0; i < SESSIONS_SHARDS; i++) {
+            shards[i].mutex.lock();
+            count += shards[i].count;
+            shards[i].mutex.unlock();
         }
-        mutex.unlock();
+
+        return count;
     }
 }
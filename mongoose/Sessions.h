@@ -1,17 +1,30 @@
 #ifndef _MONGOOSE_SESSIONS_H
 #define _MONGOOSE_SESSIONS_H
 
+#include <time.h>
+#include <vector>
 #include "Request.h"
 #include "Session.h"
 #include "Mutex.h"
 
+/**
+ * Number of independently locked parts of the sessions table
+ */
+#define SESSIONS_SHARDS 16
+
 using namespace std;
 
 /**
  * A session contains the user specific values
- */ 
+ *
+ * The sessions are spread over shards, each with its own lock, hash table
+ * and list of sessions ordered by last use, so that the oldest sessions
+ * can be expired without scanning the others
+ */
 namespace Mongoose
 {
+    class ServerTask;
+
     class Sessions
     {
         public:
@@ -28,7 +41,7 @@ namespace Mongoose
              *
              * @return string the session ID for this request
              */
-            string getId(Request &request, Response &response);
+            virtual string getId(Request &request, Response &response);
 
             /**
              * Gets the session for a certain request
@@ -38,19 +51,159 @@ namespace Mongoose
              *
              * @return Session the session corresponding
              */
-            Session &get(Request &request, Response &response);
+            virtual Session &get(Request &request, Response &response);
 
             /**
-             * Remove all the sessions older than age
+             * Remove all the sessions older than age, this only looks at
+             * the sessions being removed
              *
              * @param int the age of the too old sessions in second
              */
-            void garbageCollect(int oldAge = 3600);
+            virtual void garbageCollect(int oldAge = 3600);
+
+            /**
+             * Is the session of a request available without waiting? The
+             * sessions stored out of the process have to be loaded before
+             * the handler runs
+             *
+             * @param Request the request
+             *
+             * @return bool true if the session can be used now
+             */
+            virtual bool _isLoaded(Request &request);
+
+            /**
+             * Loads the session of a request, the task is run on the poll
+             * thread once it is loaded, or deleted if it can't be. This is
+             * called on the poll thread
+             *
+             * @param Request the request
+             * @param ServerTask* the task to run
+             */
+            virtual void _load(Request &request, ServerTask *task);
+
+            /**
+             * Writes all the sessions in a snapshot file. The shards are
+             * copied one at a time, so the requests go on while it is
+             * written, and the previous file is replaced once the new one
+             * is complete
+             *
+             * @param string the path of the file
+             *
+             * @return bool true if the snapshot was written
+             */
+            bool save(string path);
+
+            /**
+             * Loads the sessions of a snapshot file written by save()
+             *
+             * @param string the path of the file
+             *
+             * @return bool true if the file was loaded, false if it is
+             *         missing, of another version or corrupted
+             */
+            bool load(string path);
+
+            /**
+             * Gets the number of sessions
+             *
+             * @return size_t the number of sessions
+             */
+            size_t size();
 
         protected:
-            map<string, Session*> sessions;
+            struct Entry
+            {
+                string id;
+                size_t hash;
+                Session *session;
+                time_t used;
+
+                // The values in the snapshot, until the session is created
+                const char *record;
+                size_t recordSize;
+
+                // Next entry of the hash bucket
+                Entry *next;
+
+                // Neighbours in the last use order
+                Entry *older;
+                Entry *newer;
+            };
+
+            struct Shard
+            {
+                Shard() : count(0), oldest(NULL), newest(NULL) {}
+
+                Mutex mutex;
+                vector<Entry *> buckets;
+                size_t count;
+                Entry *oldest;
+                Entry *newest;
+            };
+
+            static size_t hash(const char *data, size_t size);
+
+            /**
+             * Generates a new session id
+             */
+            static string generateId();
+
+            /**
+             * Creates the session for an id, this is called with the shard
+             * locked
+             */
+            virtual Session *createSession(const char *id, size_t size);
+
+            /**
+             * Gets the session with the given id, creating it if needed.
+             * The session is marked as used now
+             */
+            Session *lookup(const char *id, size_t size);
+
+            /**
+             * Finds and inserts entries, the shard must be locked
+             */
+            Entry *find(Shard &shard, size_t value, const char *id, size_t size);
+            Entry *insert(Shard &shard, size_t value, const char *id, size_t size);
+
+            /**
+             * Creates the session of an entry loaded from a snapshot, the
+             * shard must be locked
+             */
+            void restore(Entry *entry);
+
+            /**
+             * Gets the age of the session of an entry, the shard must be locked
+             */
+            int getAge(Entry *entry);
+
+            struct Snapshot
+            {
+                void *data;
+                size_t size;
+            };
+
+            static void release(Snapshot &snapshot);
+
+            /**
+             * Moves an entry to the newest end of its shard, the shard
+             * must be locked
+             */
+            void touch(Shard &shard, Entry *entry, time_t now);
+            void unlink(Shard &shard, Entry *entry);
+
+            /**
+             * Doubles the number of buckets of a shard, the shard must
+             * be locked
+             */
+            void grow(Shard &shard);
+
+            Shard shards[SESSIONS_SHARDS];
             string key;
-            Mutex mutex;
+
+            // The loaded snapshots, kept for the sessions not created yet
+            vector<Snapshot> snapshots;
     };
 }
 
@@ -1,3 +1,5 @@
+#include <stdlib.h>
+#include <string.h>
 #include <sstream>
 #include "StreamResponse.h"
 
@@ -5,8 +7,92 @@ using namespace std;
 
 namespace Mongoose
 {
+    StreamResponse::Buffer::Buffer(Arena *arena_)
+        : arena(arena_), storage(NULL), capacity(0), heap(false)
+    {
+    }
+
+    StreamResponse::Buffer::~Buffer()
+    {
+        if (heap) {
+            free(storage);
+        }
+    }
+
+    int StreamResponse::Buffer::overflow(int c)
+    {
+        if (c == EOF) {
+            return 0;
+        }
+
+        size_t used = size();
+        size_t grown = capacity == 0 ? 256 : capacity * 2;
+        char *next;
+
+        // The arena only takes back its last allocation, a large body would
+        // leave all its previous buffers there until the response is freed
+        if (grown <= RESPONSE_ARENA_SIZE) {
+            next = (char *) arena->allocate(grown);
+            if (used > 0) {
+                memcpy(next, storage, used);
+            }
+        } else if (heap) {
+            next = (char *) realloc(storage, grown);
+        } else {
+            next = (char *) malloc(grown);
+            if (next != NULL) {
+                if (used > 0) {
+                    memcpy(next, storage, used);
+                }
+                heap = true;
+            }
+        }
+        if (next == NULL) {
+            return EOF;
+        }
+        storage = next;
+        capacity = grown;
+
+        // The put area follows the storage
+        setp(storage, storage + capacity);
+        pbump(used);
+
+        *pptr() = c;
+        pbump(1);
+
+        return c;
+    }
+
+    const char *StreamResponse::Buffer::data()
+    {
+        return pbase();
+    }
+
+    size_t StreamResponse::Buffer::size()
+    {
+        return pptr() - pbase();
+    }
+
+    StreamResponse::StreamResponse()
+        : ostream(NULL), buffer(&arena)
+    {
+        rdbuf(&buffer);
+    }
+
     string StreamResponse::getBody()
     {
-        return this->str();
+        return str();
+    }
+
+    string StreamResponse::str()
+    {
+        return string(buffer.data(), buffer.size());
+    }
+
+    bool StreamResponse::getBodyData(struct mg_str &body)
+    {
+        body = mg_mk_str_n(buffer.data(), buffer.size());
+
+        return true;
     }
 }
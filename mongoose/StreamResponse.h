@@ -11,18 +11,69 @@ using namespace std;
 
 /**
  * A stream response to a request
+ *
+ * A small body is buffered in the response arena, a larger one on the
+ * heap, it is sent straight from there when the response is written
  */
 namespace Mongoose
 {
-    class StreamResponse : public ostringstream, public Response
+    class StreamResponse : public ostream, public Response
     {
         public:
+            StreamResponse();
+
             /**
              * Gets the response body
              *
              * @return string the response body
              */
             virtual string getBody();
+
+            /**
+             * Gets the response body, like ostringstream::str()
+             *
+             * @return string the response body
+             */
+            string str();
+
+            /**
+             * Gets the body in place, in the stream buffer
+             *
+             * @param struct mg_str the response body
+             *
+             * @return bool always true
+             */
+            virtual bool getBodyData(struct mg_str &body);
+
+        protected:
+            /**
+             * Stream buffer growing in the response arena while it is not
+             * larger than RESPONSE_ARENA_SIZE, then on the heap, where the
+             * previous storage is freed as it grows
+             */
+            class Buffer : public streambuf
+            {
+                public:
+                    Buffer(Arena *arena);
+                    virtual ~Buffer();
+
+                    const char *data();
+                    size_t size();
+
+                protected:
+                    virtual int overflow(int c);
+
+                    Arena *arena;
+                    char *storage;
+                    size_t capacity;
+                    bool heap;
+
+                private:
+                    Buffer(const Buffer &);
+                    Buffer &operator=(const Buffer &);
+            };
+
+            Buffer buffer;
     };
 }
 
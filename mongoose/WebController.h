@@ -19,8 +19,10 @@ namespace Mongoose
     {
         public:
             /**
-             * Creates a web controller, each gcDivisor request, the sessions will be
-             * garbage collected
+             * Creates a web controller
+             *
+             * @param int unused, the sessions are now garbage collected by
+             *        the server every second
              */
             WebController(int gcDivisor = 100);
 
@@ -34,9 +36,7 @@ namespace Mongoose
             void preProcess(Request &request, Response &response);
 
         protected:
-            Mutex mutex;
             int gcDivisor;
-            int counter;
     };
 }
 
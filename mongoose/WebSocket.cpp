@@ -2,14 +2,144 @@
 #include <sstream>
 #include "WebSocket.h"
 #include "WebSockets.h"
+#include "Server.h"
+#ifdef ENABLE_WEBSOCKET_DEFLATE
+#include "WebSocketDeflate.h"
+#endif
 
 using namespace std;
 
 namespace Mongoose
 {
-    WebSocket::WebSocket(struct mg_connection *connection_)
-        : connection(connection_), closed(false), request(connection_), data(""), id(-1)
+    WebSocketFrame::WebSocketFrame(const char *payload, size_t size, int opcode_, bool compressed_)
+        : opcode(opcode_ & 0x0f), references(1)
     {
+        unsigned char header[10];
+
+        header[0] = WEBSOCKET_FIN | (compressed_ ? WEBSOCKET_RSV1 : 0) | opcode;
+        if (size < 126) {
+            header[1] = size;
+            headerSize = 2;
+        } else if (size < 65536) {
+            header[1] = 126;
+            header[2] = (size >> 8) & 0xff;
+            header[3] = size & 0xff;
+            headerSize = 4;
+        } else {
+            header[1] = 127;
+            for (int i = 0; i < 8; i++) {
+                header[2 + i] = ((uint64_t) size >> (8 * (7 - i))) & 0xff;
+            }
+            headerSize = 10;
+        }
+
+        data.reserve(headerSize + size);
+        data.append((const char *) header, headerSize);
+        data.append(payload, size);
+    }
+
+    WebSocketFrame::~WebSocketFrame()
+    {
+#ifdef ENABLE_WEBSOCKET_DEFLATE
+        map<int, WebSocketFrame *>::iterator it;
+        for (it=compressed.begin(); it!=compressed.end(); it++) {
+            if ((*it).second != NULL) {
+                (*it).second->release();
+            }
+        }
+#endif
+    }
+
+    void WebSocketFrame::acquire()
+    {
+        references.increment();
+    }
+
+    void WebSocketFrame::release()
+    {
+        if (references.decrement() == 0) {
+            delete this;
+        }
+    }
+
+    const char *WebSocketFrame::getData()
+    {
+        return data.data();
+    }
+
+    size_t WebSocketFrame::getSize()
+    {
+        return data.size();
+    }
+
+    const char *WebSocketFrame::getPayload()
+    {
+        return data.data() + headerSize;
+    }
+
+    size_t WebSocketFrame::getPayloadSize()
+    {
+        return data.size() - headerSize;
+    }
+
+    int WebSocketFrame::getOpcode()
+    {
+        return opcode;
+    }
+
+#ifdef ENABLE_WEBSOCKET_DEFLATE
+    WebSocketFrame *WebSocketFrame::getCompressed(int windowBits)
+    {
+        // The poll threads of several servers can share a frame
+        mutex.lock();
+        map<int, WebSocketFrame *>::iterator it = compressed.find(windowBits);
+        WebSocketFrame *frame;
+
+        if (it != compressed.end()) {
+            frame = (*it).second;
+        } else {
+            string payload;
+
+            if (WebSocketDeflate::compressOnce(getPayload(), getPayloadSize(), windowBits, payload)) {
+                frame = new WebSocketFrame(payload.data(), payload.size(), opcode, true);
+            } else {
+                frame = NULL;
+            }
+            compressed[windowBits] = frame;
+        }
+
+        if (frame != NULL) {
+            frame->acquire();
+        }
+        mutex.unlock();
+
+        return frame;
+    }
+#endif
+
+    WebSocket::WebSocket(Server *server_, struct mg_connection *connection_, Request *request_)
+        : id(-1), data(""), server(server_), request(request_), connection(connection_), closed(false), closing(false), scheduled(false),
+        highWatermark(WEBSOCKET_HIGH_WATERMARK), lowWatermark(WEBSOCKET_LOW_WATERMARK), overflow(OVERFLOW_DISCONNECT),
+        queuedBytes(0), pendingBytes(0), saturated(false),
+        deflate(NULL), threshold(0), compression(true), streaming(false), opcode(WEBSOCKET_OP_TEXT),
+        compressed(false), fin(true)
+    {
+    }
+
+    WebSocket::~WebSocket()
+    {
+        deque<WebSocketFrame *>::iterator it;
+        for (it=queue.begin(); it!=queue.end(); it++) {
+            (*it)->release();
+        }
+
+        delete request;
+
+#ifdef ENABLE_WEBSOCKET_DEFLATE
+        if (deflate != NULL) {
+            delete deflate;
+        }
+#endif
     }
 
     void WebSocket::setId(int id_)
@@ -37,36 +167,307 @@ namespace Mongoose
 
     Request &WebSocket::getRequest()
     {
-        return request;
+        return *request;
     }
 
-    void WebSocket::send(string data, int opcode)
+    void WebSocket::send(const string &data, int opcode)
     {
-        if (isClosed()) {
+        send(mg_mk_str_n(data.data(), data.size()), opcode);
+    }
+
+    void WebSocket::send(const struct mg_str &data, int opcode)
+    {
+        if (!_accept()) {
             return;
         }
 
-        mutex.lock();
-        if (!mg_websocket_write(connection, opcode, data.c_str(), data.size())) {
-            closed = true;
+        WebSocketFrame *frame = new WebSocketFrame(data.p, data.len, opcode);
+        server->_webSocketSend(vector<int>(1, id), frame);
+        frame->release();
+    }
+
+    void WebSocket::send(WebSocketFrame *frame)
+    {
+        if (!_accept()) {
+            return;
         }
-        mutex.unlock();
+
+        server->_webSocketSend(vector<int>(1, id), frame);
+    }
+
+    bool WebSocket::isCompressed()
+    {
+        return deflate != NULL;
+    }
+
+    void WebSocket::setCompression(bool compression_)
+    {
+        compression = compression_;
+    }
+
+    void WebSocket::_setDeflate(WebSocketDeflate *deflate_, size_t threshold_)
+    {
+        deflate = deflate_;
+        threshold = threshold_;
+    }
+
+    void WebSocket::setStreaming(bool streaming_)
+    {
+        streaming = streaming_;
+    }
+
+    bool WebSocket::isStreaming()
+    {
+        return streaming;
+    }
+
+    int WebSocket::getOpcode()
+    {
+        return opcode;
+    }
+
+    bool WebSocket::isFinal()
+    {
+        return fin;
+    }
+
+    bool WebSocket::_receive(struct mg_str &data, int flags)
+    {
+        // The first fragment gives the opcode and the compression of the message
+        if ((flags & 0x0f) != 0) {
+            opcode = flags & 0x0f;
+            compressed = (flags & WEBSOCKET_RSV1) != 0;
+        }
+        fin = (flags & WEBSOCKET_FIN) != 0;
+
+        if (compressed) {
+            return _decompress(data, fin);
+        }
+
+        return true;
+    }
+
+    bool WebSocket::_decompress(struct mg_str &data, bool last)
+    {
+#ifdef ENABLE_WEBSOCKET_DEFLATE
+        // The previous data are no longer used, a large buffer is not kept
+        if (inflated.capacity() > WEBSOCKET_RECEIVE_BUFFER) {
+            string().swap(inflated);
+        }
+
+        if (deflate != NULL && deflate->decompress(data.p, data.len, inflated, last)) {
+            data.p = inflated.data();
+            data.len = inflated.size();
+            return true;
+        }
+#else
+        (void) data;
+        (void) last;
+#endif
+
+        return false;
+    }
+
+#ifdef ENABLE_WEBSOCKET_DEFLATE
+    WebSocketFrame *WebSocket::compress(WebSocketFrame *frame)
+    {
+        int opcode = frame->getOpcode();
+
+        if (deflate == NULL || !compression || frame->getPayloadSize() < threshold ||
+                (opcode != WEBSOCKET_OP_TEXT && opcode != WEBSOCKET_OP_BINARY)) {
+            return frame;
+        }
+
+        const WebSocketDeflate::Parameters &parameters = deflate->getParameters();
+        WebSocketFrame *compressed = NULL;
+
+        if (parameters.serverNoContextTakeover) {
+            compressed = frame->getCompressed(parameters.serverWindowBits);
+        } else {
+            string payload;
+
+            if (deflate->compress(frame->getPayload(), frame->getPayloadSize(), payload)) {
+                compressed = new WebSocketFrame(payload.data(), payload.size(), opcode, true);
+            }
+        }
+
+        // The context can't be trusted anymore, the next messages are sent as is
+        if (compressed == NULL) {
+            compression = false;
+            return frame;
+        }
+
+        frame->release();
+        return compressed;
+    }
+#endif
+
+    void WebSocket::setBackpressure(size_t highWatermark_, size_t lowWatermark_, Overflow overflow_)
+    {
+        highWatermark = highWatermark_;
+        lowWatermark = lowWatermark_ < highWatermark_ ? lowWatermark_ : highWatermark_;
+        overflow = overflow_;
+    }
+
+    size_t WebSocket::getPendingBytes()
+    {
+        return pendingBytes;
+    }
+
+    bool WebSocket::isSaturated()
+    {
+        return saturated;
+    }
+
+    long WebSocket::getDropped()
+    {
+        return dropped.get();
+    }
+
+    bool WebSocket::_accept()
+    {
+        if (closed) {
+            return false;
+        }
+
+        // Saves queuing a frame that would be dropped on the poll thread
+        if (saturated && overflow == OVERFLOW_DROP_NEWEST) {
+            dropped.increment();
+            return false;
+        }
+
+        return true;
+    }
+
+    void WebSocket::dropQueued(size_t count)
+    {
+        for (size_t i = 0; i < count && !queue.empty(); i++) {
+            WebSocketFrame *frame = queue.front();
+            queue.pop_front();
+
+            queuedBytes -= frame->getSize();
+            frame->release();
+            dropped.increment();
+        }
+    }
+
+    void WebSocket::updatePending()
+    {
+        pendingBytes = queuedBytes + connection->send_mbuf.len;
+
+        if (highWatermark > 0 && pendingBytes > highWatermark) {
+            saturated = true;
+        } else if (pendingBytes <= lowWatermark) {
+            saturated = false;
+        }
+    }
+
+    void WebSocket::_queue(WebSocketFrame *frame)
+    {
+        updatePending();
+
+        if (saturated) {
+            switch (overflow) {
+                case OVERFLOW_DROP_NEWEST:
+                    dropped.increment();
+                    return;
+                case OVERFLOW_COALESCE:
+                    dropQueued(queue.size());
+                    break;
+                case OVERFLOW_DISCONNECT:
+                    // What the client did not get yet is lost with it
+                    dropQueued(queue.size());
+                    dropped.increment();
+                    closed = true;
+                    connection->flags |= MG_F_CLOSE_IMMEDIATELY;
+                    return;
+                default:
+                    break;
+            }
+        }
+
+        frame->acquire();
+        queue.push_back(frame);
+        queuedBytes += frame->getSize();
+
+        // The oldest frames make room for the new one
+        if (saturated && overflow == OVERFLOW_DROP_OLDEST) {
+            while (queue.size() > 1 && queuedBytes + connection->send_mbuf.len > highWatermark) {
+                dropQueued(1);
+            }
+        }
+
+        updatePending();
+    }
+
+    void WebSocket::_close()
+    {
+        closing = true;
+    }
+
+    void WebSocket::_markClosed()
+    {
+        closed = true;
+    }
+
+    bool WebSocket::_schedule()
+    {
+        if (scheduled) {
+            return false;
+        }
+        scheduled = true;
+
+        return true;
+    }
+
+    void WebSocket::_flush()
+    {
+        scheduled = false;
+
+        // A closing websocket sends what remains before the connection goes
+        while (!queue.empty() && (closing || connection->send_mbuf.len < WEBSOCKET_SEND_BUFFER)) {
+            WebSocketFrame *frame = queue.front();
+            queue.pop_front();
+            queuedBytes -= frame->getSize();
+
+#ifdef ENABLE_WEBSOCKET_DEFLATE
+            // Compressed as it is sent, so that the contexts follow the order
+            frame = compress(frame);
+#endif
+            mg_send(connection, frame->getData(), frame->getSize());
+            frame->release();
+        }
+
+        if (closing) {
+            connection->flags |= MG_F_SEND_AND_CLOSE;
+        }
+
+        updatePending();
     }
 
     void WebSocket::notifyContainers()
     {
-        vector<WebSockets *>::iterator it;
+        vector<WebSockets *> current;
 
+        // The containers remove themselves from the list
         mutex.lock();
-        for (it=containers.begin(); it!=containers.end(); it++) {
+        current = containers;
+        mutex.unlock();
+
+        vector<WebSockets *>::iterator it;
+        for (it=current.begin(); it!=current.end(); it++) {
             (*it)->remove(this);
         }
-        mutex.unlock();
     }
 
     void WebSocket::close()
     {
-        closed = true;
+        if (!closed) {
+            closed = true;
+
+            // After the frames sent before
+            server->_webSocketClose(id);
+        }
     }
 
     bool WebSocket::isClosed()
@@ -99,5 +500,9 @@ namespace Mongoose
     {
         return connection;
     }
-};
 
+    Server *WebSocket::getServer()
+    {
+        return server;
+    }
+};
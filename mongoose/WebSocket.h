@@ -1,6 +1,8 @@
 #ifndef _MONGOOSE_WEBSOCKET_H
 #define _MONGOOSE_WEBSOCKET_H
 
+#include <map>
+#include <deque>
 #include <vector>
 #include <iostream>
 #include <mongoose.h>
@@ -11,21 +13,229 @@ using namespace std;
 
 #define WEBSOCKET_FIN 0x80
 
+/**
+ * Bit of the first frame header byte flagging a compressed message
+ */
+#define WEBSOCKET_RSV1 0x40
+
+/**
+ * The frames queued on a connection are moved to its send buffer while the
+ * buffer holds less than this, in bytes
+ */
+#define WEBSOCKET_SEND_BUFFER 65536
+
+/**
+ * The buffer inflating the messages received is kept for the next ones while
+ * it is not larger than this, in bytes
+ */
+#define WEBSOCKET_RECEIVE_BUFFER 65536
+
+/**
+ * Default watermarks of the bytes waiting to be sent on a connection: over
+ * the high one, the overflow policy applies until they drain under the low one
+ */
+#define WEBSOCKET_HIGH_WATERMARK (4 * 1024 * 1024)
+#define WEBSOCKET_LOW_WATERMARK (1024 * 1024)
+
 namespace Mongoose
 {
+    class Server;
     class WebSockets;
+    class WebSocketDeflate;
+
+    /**
+     * A frame encoded once, header and payload, shared by reference between
+     * the send queues of all the connections it is sent to
+     */
+    class WebSocketFrame
+    {
+        public:
+            /**
+             * Encodes a frame, the creator holds the first reference
+             *
+             * @param char* the payload
+             * @param size_t the payload size
+             * @param int the opcode
+             * @param bool whether the payload is compressed
+             */
+            WebSocketFrame(const char *payload, size_t size, int opcode = WEBSOCKET_OP_TEXT, bool compressed = false);
+
+            void acquire();
+            void release();
+
+            /**
+             * Gets the encoded frame
+             */
+            const char *getData();
+            size_t getSize();
+
+            /**
+             * Gets the payload
+             */
+            const char *getPayload();
+            size_t getPayloadSize();
+
+            int getOpcode();
+
+#ifdef ENABLE_WEBSOCKET_DEFLATE
+            /**
+             * Gets the frame compressed without context takeover, it is
+             * compressed once for all the connections using the same window
+             *
+             * @param int the window size, in bits
+             *
+             * @return WebSocketFrame* the compressed frame, with a reference
+             *         for the caller, or NULL if it can't be compressed
+             */
+            WebSocketFrame *getCompressed(int windowBits);
+#endif
+
+        protected:
+            virtual ~WebSocketFrame();
+
+            string data;
+            size_t headerSize;
+            int opcode;
+            AtomicCounter references;
+
+#ifdef ENABLE_WEBSOCKET_DEFLATE
+            Mutex mutex;
+            map<int, WebSocketFrame *> compressed;
+#endif
+
+        private:
+            WebSocketFrame(const WebSocketFrame &);
+            WebSocketFrame &operator=(const WebSocketFrame &);
+    };
 
     class WebSocket
     {
         public:
-            WebSocket(struct mg_connection *connection_);
+            /**
+             * What is done with the messages sent to a client that does not
+             * read them fast enough
+             */
+            enum Overflow
+            {
+                OVERFLOW_DROP_OLDEST,   // The oldest messages waiting are dropped
+                OVERFLOW_DROP_NEWEST,   // The new messages are dropped
+                OVERFLOW_COALESCE,      // Only the latest message is kept
+                OVERFLOW_DISCONNECT     // The connection is closed
+            };
 
             /**
-             * Sends data through the web socket
+             * Creates the websocket of an upgraded connection
+             *
+             * @param Server* the server of the connection
+             * @param struct mg_connection* the connection
+             * @param Request* the handshake request, detached, the websocket takes it
+             */
+            WebSocket(Server *server, struct mg_connection *connection_, Request *request);
+            virtual ~WebSocket();
+
+            /**
+             * Sends data through the web socket, this can be called from any
+             * thread, the frame is written by the poll thread
              *
              * @param string the data to send
              */
-            void send(string data, int opcode = WEBSOCKET_OP_TEXT);
+            void send(const string &data, int opcode = WEBSOCKET_OP_TEXT);
+
+            /**
+             * Sends binary data through the web socket
+             *
+             * @param mg_str the data to send, copied once in the frame
+             * @param int the opcode
+             */
+            void send(const struct mg_str &data, int opcode = WEBSOCKET_OP_BINARY);
+
+            /**
+             * Sends a frame already encoded, that can be shared with other
+             * websockets without copying it
+             *
+             * @param WebSocketFrame* the frame, a reference is taken
+             */
+            void send(WebSocketFrame *frame);
+
+            /**
+             * Is the permessage-deflate extension used on the connection ?
+             *
+             * @return bool true if the messages can be compressed
+             */
+            bool isCompressed();
+
+            /**
+             * Sets whether the messages sent are compressed, when the
+             * extension is used, this is on by default
+             *
+             * @param bool true to compress the messages
+             */
+            void setCompression(bool compression);
+
+            /**
+             * Sets whether the messages received are given to the controllers
+             * fragment by fragment, as they come, instead of once they are
+             * whole, for messages too large to be buffered. This must be set
+             * when the controllers are told that the websocket is ready
+             *
+             * @param bool true to stream the messages
+             */
+            void setStreaming(bool streaming);
+
+            /**
+             * Are the messages received streamed ?
+             *
+             * @return bool true if the fragments are given as they come
+             */
+            bool isStreaming();
+
+            /**
+             * Gets the opcode of the message being received
+             *
+             * @return int the opcode
+             */
+            int getOpcode();
+
+            /**
+             * Does the data received end its message ? This is always true
+             * unless the messages are streamed
+             *
+             * @return bool true if the message is complete
+             */
+            bool isFinal();
+
+            /**
+             * Sets how much can wait to be sent on the connection, and what
+             * is done with the messages beyond that. The messages are
+             * dropped whole, before they are compressed
+             *
+             * @param size_t the bytes waiting over which the policy applies,
+             *               0 to never apply it
+             * @param size_t the bytes waiting under which it stops applying
+             * @param Overflow the policy
+             */
+            void setBackpressure(size_t highWatermark, size_t lowWatermark, Overflow overflow);
+
+            /**
+             * Gets the bytes waiting to be sent, queued or in the send buffer
+             *
+             * @return size_t the bytes, as of the last write
+             */
+            size_t getPendingBytes();
+
+            /**
+             * Is the overflow policy applying ?
+             *
+             * @return bool true if the client is too late
+             */
+            bool isSaturated();
+
+            /**
+             * Gets the number of messages dropped by the overflow policy
+             *
+             * @return long the messages dropped
+             */
+            long getDropped();
 
             /**
              * Returns the connection request
@@ -67,6 +277,13 @@ namespace Mongoose
              */
             struct mg_connection *getConnection();
 
+            /**
+             * Gets the server of the connection
+             *
+             * @return Server* the server
+             */
+            Server *getServer();
+
             /**
              * Adding this websocket in a container
              *
@@ -98,15 +315,149 @@ namespace Mongoose
              */
             int getId();
 
+            /**
+             * Internally used to queue a frame, applying the overflow policy,
+             * this is called on the poll thread and takes a reference to the
+             * frame
+             *
+             * @param WebSocketFrame* the frame
+             */
+            void _queue(WebSocketFrame *frame);
+
+            /**
+             * Internally used to skip a websocket that would drop a message
+             * sent to it, the message is then counted as dropped
+             *
+             * @return bool true if the message can be sent
+             */
+            bool _accept();
+
+            /**
+             * Internally used to set the compression agreed with the client,
+             * the websocket takes it
+             *
+             * @param WebSocketDeflate* the compression
+             * @param size_t the size under which the messages are not compressed
+             */
+            void _setDeflate(WebSocketDeflate *deflate, size_t threshold);
+
+            /**
+             * Internally used to handle the data of a frame received, a
+             * whole message or one of its fragments, this is called on the
+             * poll thread
+             *
+             * @param mg_str the data, pointed to the inflated data if it is
+             *        compressed, until the next frame
+             * @param int the frame flags
+             *
+             * @return bool false if the data can't be inflated
+             */
+            bool _receive(struct mg_str &data, int flags);
+
+            /**
+             * Internally used to inflate a message received compressed, or
+             * one of its fragments
+             *
+             * @param mg_str the data, pointed to the inflated data
+             * @param bool whether the data ends the message
+             *
+             * @return bool false if the data can't be inflated
+             */
+            bool _decompress(struct mg_str &data, bool last = true);
+
+            /**
+             * Internally used to close the connection once the queued frames
+             * are sent, this is called on the poll thread
+             */
+            void _close();
+
+            /**
+             * Internally used to mark the websocket closed when it is removed
+             * from the server, nothing is left to send on its connection
+             */
+            void _markClosed();
+
+            /**
+             * Internally used to batch the frames queued at once, this is
+             * called on the poll thread
+             *
+             * @return bool true if the websocket was not already to be flushed
+             */
+            bool _schedule();
+
+            /**
+             * Internally used to move the queued frames to the connection as
+             * its send buffer drains, this is called on the poll thread
+             */
+            void _flush();
+
         protected:
             int id;
             Mutex mutex;
             string data;
-            Request request;
+            Server *server;
+            Request *request;
             struct mg_connection *connection;
-            bool closed;
+            volatile bool closed;
+
+            // Frames waiting for room in the send buffer, whether the
+            // connection closes after them and whether a flush is scheduled,
+            // used on the poll thread
+            deque<WebSocketFrame *> queue;
+            bool closing;
+            bool scheduled;
+
+            // The backpressure, the sizes being written on the poll thread
+            size_t highWatermark;
+            size_t lowWatermark;
+            Overflow overflow;
+            size_t queuedBytes;
+            volatile size_t pendingBytes;
+            volatile bool saturated;
+            AtomicCounter dropped;
+
+            /**
+             * Drops the oldest frames queued
+             *
+             * @param size_t the number of frames
+             */
+            void dropQueued(size_t count);
+
+            /**
+             * Updates the bytes waiting and whether the policy applies
+             */
+            void updatePending();
 
             vector<WebSockets *> containers;
+
+            // The compression, used on the poll thread
+            WebSocketDeflate *deflate;
+            size_t threshold;
+            volatile bool compression;
+
+            // The message being received, used on the poll thread
+            volatile bool streaming;
+            int opcode;
+            bool compressed;
+            bool fin;
+
+            // Keeps its capacity from a message to the next
+            string inflated;
+
+#ifdef ENABLE_WEBSOCKET_DEFLATE
+            /**
+             * Replaces a frame by its compressed version, if it is worth it
+             *
+             * @param WebSocketFrame* the frame, whose reference is taken
+             *
+             * @return WebSocketFrame* the frame to send, with a reference
+             */
+            WebSocketFrame *compress(WebSocketFrame *frame);
+#endif
+
+        private:
+            WebSocket(const WebSocket &);
+            WebSocket &operator=(const WebSocket &);
     };
 }
 
@@ -0,0 +1,297 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <vector>
+#include "WebSocketDeflate.h"
+
+using namespace std;
+
+static z_stream *createDeflater(int windowBits)
+{
+    z_stream *stream = new z_stream;
+    memset(stream, 0, sizeof(z_stream));
+
+    // The hash table is sized like the window, raw deflate has no header
+    if (deflateInit2(stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -windowBits,
+                windowBits - 7, Z_DEFAULT_STRATEGY) != Z_OK) {
+        delete stream;
+        return NULL;
+    }
+
+    return stream;
+}
+
+static void destroyDeflater(z_stream *stream)
+{
+    deflateEnd(stream);
+    delete stream;
+}
+
+static bool deflateMessage(z_stream *stream, const char *data, size_t size, string &out)
+{
+    char buffer[16384];
+
+    out.clear();
+    stream->next_in = (Bytef *) data;
+    stream->avail_in = size;
+
+    do {
+        stream->next_out = (Bytef *) buffer;
+        stream->avail_out = sizeof(buffer);
+
+        int result = deflate(stream, Z_SYNC_FLUSH);
+        if (result != Z_OK && result != Z_BUF_ERROR) {
+            return false;
+        }
+        out.append(buffer, sizeof(buffer) - stream->avail_out);
+    } while (stream->avail_out == 0);
+
+    // The message ends with an empty block, its 00 00 ff ff is not sent
+    if (out.size() >= 4 && memcmp(out.data() + out.size() - 4, "\x00\x00\xff\xff", 4) == 0) {
+        out.resize(out.size() - 4);
+    }
+
+    return true;
+}
+
+/**
+ * Reads a window size parameter, from 8 to 15, its value can be quoted
+ */
+static int parseWindowBits(const string &value)
+{
+    string bits = value;
+
+    if (bits.size() >= 2 && bits[0] == '"' && bits[bits.size() - 1] == '"') {
+        bits = bits.substr(1, bits.size() - 2);
+    }
+    if (bits.size() < 1 || bits.size() > 2 || bits.find_first_not_of("0123456789") != string::npos) {
+        return -1;
+    }
+
+    int windowBits = atoi(bits.c_str());
+
+    return (windowBits >= 8 && windowBits <= 15) ? windowBits : -1;
+}
+
+static string trim(const string &value)
+{
+    size_t begin = value.find_first_not_of(" \t");
+    size_t end = value.find_last_not_of(" \t");
+
+    return begin == string::npos ? string() : value.substr(begin, end - begin + 1);
+}
+
+namespace Mongoose
+{
+    bool WebSocketDeflate::negotiate(const struct mg_str &offers, int windowBits, bool contextTakeover,
+            Parameters &parameters, string &extension)
+    {
+        string header(offers.p, offers.len);
+        size_t offset = 0;
+
+        // The offers are tried in the order of preference of the client
+        while (offset <= header.size()) {
+            size_t end = header.find(',', offset);
+            if (end == string::npos) {
+                end = header.size();
+            }
+            string offer = header.substr(offset, end - offset);
+            offset = end + 1;
+
+            vector<string> tokens;
+            size_t position = 0;
+            while (position <= offer.size()) {
+                size_t next = offer.find(';', position);
+                if (next == string::npos) {
+                    next = offer.size();
+                }
+                tokens.push_back(trim(offer.substr(position, next - position)));
+                position = next + 1;
+            }
+            if (tokens[0] != "permessage-deflate") {
+                continue;
+            }
+
+            bool valid = true;
+            bool serverNoContextTakeover = false, clientNoContextTakeover = false;
+            int serverMaxWindowBits = 0, clientMaxWindowBits = 0;
+
+            for (size_t i = 1; i < tokens.size() && valid; i++) {
+                string name = tokens[i], value;
+                size_t equal = name.find('=');
+
+                if (equal != string::npos) {
+                    value = trim(name.substr(equal + 1));
+                    name = trim(name.substr(0, equal));
+                }
+
+                if (name == "server_no_context_takeover" && equal == string::npos && !serverNoContextTakeover) {
+                    serverNoContextTakeover = true;
+                } else if (name == "client_no_context_takeover" && equal == string::npos && !clientNoContextTakeover) {
+                    clientNoContextTakeover = true;
+                } else if (name == "server_max_window_bits" && serverMaxWindowBits == 0) {
+                    serverMaxWindowBits = parseWindowBits(value);
+                    valid = serverMaxWindowBits > 0;
+                } else if (name == "client_max_window_bits" && clientMaxWindowBits == 0) {
+                    clientMaxWindowBits = equal == string::npos ? 15 : parseWindowBits(value);
+                    valid = clientMaxWindowBits > 0;
+                } else {
+                    valid = false;
+                }
+            }
+
+            // zlib can't compress with a 256 bytes window
+            int serverWindowBits = windowBits;
+            if (serverMaxWindowBits > 0 && serverMaxWindowBits < serverWindowBits) {
+                serverWindowBits = serverMaxWindowBits;
+            }
+            if (!valid || serverWindowBits < 9) {
+                continue;
+            }
+
+            parameters.serverWindowBits = serverWindowBits;
+            parameters.serverNoContextTakeover = serverNoContextTakeover || !contextTakeover;
+            parameters.clientNoContextTakeover = clientNoContextTakeover || !contextTakeover;
+
+            // Without the parameter, the client may use the largest window
+            int clientWindowBits = 15;
+            if (clientMaxWindowBits > 0 && windowBits < clientMaxWindowBits) {
+                clientWindowBits = windowBits;
+            } else if (clientMaxWindowBits > 0) {
+                clientWindowBits = clientMaxWindowBits;
+            }
+            parameters.clientWindowBits = clientWindowBits < 9 ? 9 : clientWindowBits;
+
+            char value[48];
+            extension = "permessage-deflate";
+            if (parameters.serverNoContextTakeover) {
+                extension += "; server_no_context_takeover";
+            }
+            if (parameters.clientNoContextTakeover) {
+                extension += "; client_no_context_takeover";
+            }
+            if (serverMaxWindowBits > 0 || serverWindowBits < 15) {
+                snprintf(value, sizeof(value), "; server_max_window_bits=%d", serverWindowBits);
+                extension += value;
+            }
+            if (clientMaxWindowBits > 0) {
+                snprintf(value, sizeof(value), "; client_max_window_bits=%d", clientWindowBits);
+                extension += value;
+            }
+
+            return true;
+        }
+
+        return false;
+    }
+
+    bool WebSocketDeflate::compressOnce(const char *data, size_t size, int windowBits, string &out)
+    {
+        z_stream *stream = createDeflater(windowBits);
+
+        if (stream == NULL) {
+            return false;
+        }
+
+        bool result = deflateMessage(stream, data, size, out);
+        destroyDeflater(stream);
+
+        return result;
+    }
+
+    WebSocketDeflate::WebSocketDeflate(const Parameters &parameters_)
+        : parameters(parameters_), deflater(NULL), inflater(NULL)
+    {
+    }
+
+    WebSocketDeflate::~WebSocketDeflate()
+    {
+        if (deflater != NULL) {
+            destroyDeflater(deflater);
+        }
+        if (inflater != NULL) {
+            inflateEnd(inflater);
+            delete inflater;
+        }
+    }
+
+    const WebSocketDeflate::Parameters &WebSocketDeflate::getParameters()
+    {
+        return parameters;
+    }
+
+    bool WebSocketDeflate::compress(const char *data, size_t size, string &out)
+    {
+        if (parameters.serverNoContextTakeover) {
+            return compressOnce(data, size, parameters.serverWindowBits, out);
+        }
+
+        if (deflater == NULL) {
+            deflater = createDeflater(parameters.serverWindowBits);
+
+            if (deflater == NULL) {
+                return false;
+            }
+        }
+
+        return deflateMessage(deflater, data, size, out);
+    }
+
+    bool WebSocketDeflate::decompress(const char *data, size_t size, string &out, bool last)
+    {
+        static const char tail[4] = {0x00, 0x00, (char) 0xff, (char) 0xff};
+
+        if (inflater == NULL) {
+            inflater = new z_stream;
+            memset(inflater, 0, sizeof(z_stream));
+
+            if (inflateInit2(inflater, -parameters.clientWindowBits) != Z_OK) {
+                delete inflater;
+                inflater = NULL;
+                return false;
+            }
+        }
+
+        // The message, then the end of the empty block the client left out
+        const char *inputs[2] = {data, tail};
+        size_t sizes[2] = {size, sizeof(tail)};
+        char buffer[16384];
+        bool valid = true;
+
+        out.clear();
+        for (int i = 0; i < (last ? 2 : 1) && valid; i++) {
+            inflater->next_in = (Bytef *) inputs[i];
+            inflater->avail_in = sizes[i];
+
+            do {
+                inflater->next_out = (Bytef *) buffer;
+                inflater->avail_out = sizeof(buffer);
+
+                int result = inflate(inflater, Z_SYNC_FLUSH);
+                out.append(buffer, sizeof(buffer) - inflater->avail_out);
+
+                if (result == Z_STREAM_END) {
+                    // The client ended its stream, the next message starts a new one
+                    inflateReset(inflater);
+                    break;
+                }
+                if ((result != Z_OK && result != Z_BUF_ERROR) || out.size() > WEBSOCKET_DEFLATE_MAX_MESSAGE) {
+                    valid = false;
+                    break;
+                }
+                if (result == Z_BUF_ERROR) {
+                    break;
+                }
+            } while (inflater->avail_in > 0 || inflater->avail_out == 0);
+        }
+
+        // Without context takeover, the window is not kept between messages
+        if (!valid || (last && parameters.clientNoContextTakeover)) {
+            inflateEnd(inflater);
+            delete inflater;
+            inflater = NULL;
+        }
+
+        return valid;
+    }
+}
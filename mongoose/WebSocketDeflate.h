@@ -0,0 +1,114 @@
+#ifndef _MONGOOSE_WEBSOCKET_DEFLATE_H
+#define _MONGOOSE_WEBSOCKET_DEFLATE_H
+
+#include <string>
+#include <zlib.h>
+#include <mongoose.h>
+
+/**
+ * Size above which an inflated message, or fragment when they are streamed,
+ * is refused, in bytes
+ */
+#define WEBSOCKET_DEFLATE_MAX_MESSAGE (16 * 1024 * 1024)
+
+using namespace std;
+
+/**
+ * The permessage-deflate extension of the websockets (RFC 7692)
+ *
+ * The server offers to compress with a window of at most 2^windowBits
+ * bytes, and asks the clients to do the same when they allow it. A
+ * connection keeping its compression context between messages holds a
+ * deflate stream of about 2^(windowBits + 3) bytes, created for its first
+ * compressed message. Without context takeover, the streams only live
+ * for a message, and a message broadcast is compressed once for all the
+ * connections having the same window.
+ */
+namespace Mongoose
+{
+    class WebSocketDeflate
+    {
+        public:
+            /**
+             * Parameters agreed with a client
+             */
+            struct Parameters
+            {
+                int serverWindowBits;
+                int clientWindowBits;
+                bool serverNoContextTakeover;
+                bool clientNoContextTakeover;
+            };
+
+            /**
+             * Chooses the parameters from the offers of a client
+             *
+             * @param struct mg_str the Sec-WebSocket-Extensions header
+             * @param int the largest window of the server
+             * @param bool whether the server keeps its context between messages
+             * @param Parameters the parameters chosen
+             * @param string the extension to answer
+             *
+             * @return bool true if an offer was accepted
+             */
+            static bool negotiate(const struct mg_str &offers, int windowBits, bool contextTakeover,
+                    Parameters &parameters, string &extension);
+
+            /**
+             * Compresses a message with a stream used only for it
+             *
+             * @param char* the message
+             * @param size_t the message size
+             * @param int the window size, in bits
+             * @param string the compressed message
+             *
+             * @return bool true on success
+             */
+            static bool compressOnce(const char *data, size_t size, int windowBits, string &out);
+
+            WebSocketDeflate(const Parameters &parameters);
+            virtual ~WebSocketDeflate();
+
+            /**
+             * Compresses a message sent to the client
+             *
+             * @param char* the message
+             * @param size_t the message size
+             * @param string the compressed message
+             *
+             * @return bool true on success
+             */
+            bool compress(const char *data, size_t size, string &out);
+
+            /**
+             * Inflates a message received from the client, or one of its
+             * fragments, in order
+             *
+             * @param char* the compressed data
+             * @param size_t the compressed size
+             * @param string the data inflated
+             * @param bool whether the data ends the message
+             *
+             * @return bool false if the data is invalid or too large
+             */
+            bool decompress(const char *data, size_t size, string &out, bool last = true);
+
+            /**
+             * Gets the parameters agreed
+             */
+            const Parameters &getParameters();
+
+        protected:
+            Parameters parameters;
+
+            // Created for the first message, and kept only with context takeover
+            z_stream *deflater;
+            z_stream *inflater;
+
+        private:
+            WebSocketDeflate(const WebSocketDeflate &);
+            WebSocketDeflate &operator=(const WebSocketDeflate &);
+    };
+}
+
+#endif
@@ -1,11 +1,40 @@
+#include <limits.h>
 #include <iostream>
+#include <algorithm>
 #include "WebSockets.h"
+#include "Server.h"
 
 
 namespace Mongoose
 {
+    WebSocketSubscribers::WebSocketSubscribers()
+        : references(1)
+    {
+    }
+
+    WebSocketSubscribers::WebSocketSubscribers(const WebSocketSubscribers &other)
+        : groups(other.groups), references(1)
+    {
+    }
+
+    WebSocketSubscribers::~WebSocketSubscribers()
+    {
+    }
+
+    void WebSocketSubscribers::acquire()
+    {
+        references.increment();
+    }
+
+    void WebSocketSubscribers::release()
+    {
+        if (references.decrement() == 0) {
+            delete this;
+        }
+    }
+
     WebSockets::WebSockets(bool responsible_)
-        : responsible(responsible_), id(0)
+        : responsible(responsible_), used(0), nextId(0)
     {
     }
 
@@ -26,6 +55,11 @@ namespace Mongoose
                 remove(*vit);
             }
         }
+
+        map<string, WebSocketSubscribers *>::iterator tit;
+        for (tit=topics.begin(); tit!=topics.end(); tit++) {
+            (*tit).second->release();
+        }
     }
 
     void WebSockets::add(WebSocket *websocket)
@@ -34,48 +68,295 @@ namespace Mongoose
             return;
         }
 
+        struct mg_connection *connection = websocket->getConnection();
+
+        mutex.lock();
+        map<struct mg_connection *, WebSocket *>::iterator it = websockets.find(connection);
+        if (it != websockets.end()) {
+            remove((*it).second, false);
+        }
+
         if (responsible) {
-            mutex.lock();
-            int newId = id++;
-            mutex.unlock();
-            websocket->setId(newId);
+            // At most half full, a free slot is found after a few tries
+            if (2 * (used + 1) > slots.size()) {
+                growSlots();
+            }
+
+            int id;
+            do {
+                id = nextId;
+                nextId = (nextId + 1) & INT_MAX;
+            } while (slots[id & (slots.size() - 1)] != NULL);
+
+            slots[id & (slots.size() - 1)] = websocket;
+            used++;
+            websocket->setId(id);
+        } else {
+            websocketsById[websocket->getId()] = websocket;
         }
 
-        struct mg_connection *connection = websocket->getConnection();
+        websockets.insert(make_pair(connection, websocket));
+        websocket->addContainer(this);
+        mutex.unlock();
+    }
 
+    WebSocket *WebSockets::findWebSocket(int id)
+    {
+        if (responsible) {
+            if (id >= 0 && !slots.empty()) {
+                WebSocket *websocket = slots[id & (slots.size() - 1)];
+
+                // The slot may have another identifier with the same low bits
+                if (websocket != NULL && websocket->getId() == id) {
+                    return websocket;
+                }
+            }
+        } else {
+            map<int, WebSocket *>::iterator it = websocketsById.find(id);
+
+            if (it != websocketsById.end()) {
+                return (*it).second;
+            }
+        }
+
+        return NULL;
+    }
+
+    void WebSockets::growSlots()
+    {
+        size_t size = slots.empty() ? WEBSOCKETS_MIN_SLOTS : 2 * slots.size();
+        vector<WebSocket *> grown(size, (WebSocket *) NULL);
+
+        vector<WebSocket *>::iterator it;
+        for (it=slots.begin(); it!=slots.end(); it++) {
+            if ((*it) != NULL) {
+                grown[(*it)->getId() & (size - 1)] = (*it);
+            }
+        }
+        slots.swap(grown);
+    }
+
+    WebSocket *WebSockets::getWebSocket(int id)
+    {
+        mutex.lock();
+        WebSocket *websocket = findWebSocket(id);
+        mutex.unlock();
+
+        return websocket;
+    }
+
+    void WebSockets::_getWebSockets(const vector<int> &ids, vector<WebSocket *> &found)
+    {
+        vector<int>::const_iterator it;
+
+        found.clear();
         mutex.lock();
-        if (websockets.find(connection) != websockets.end()) {
-            remove(websockets[connection], false);
+        for (it=ids.begin(); it!=ids.end(); it++) {
+            WebSocket *websocket = findWebSocket(*it);
+
+            if (websocket != NULL) {
+                found.push_back(websocket);
+            }
         }
+        mutex.unlock();
+    }
+
+    void WebSockets::sendAll(const string &data, int opcode)
+    {
+        sendAll(mg_mk_str_n(data.data(), data.size()), opcode);
+    }
 
-        websocketsById[websocket->getId()] = websocket;
-        websockets[connection] = websocket;
+    void WebSockets::sendAll(const struct mg_str &data, int opcode)
+    {
+        WebSocketFrame *frame = new WebSocketFrame(data.p, data.len, opcode);
+        sendAll(frame);
+        frame->release();
+    }
+
+    void WebSockets::sendAll(WebSocketFrame *frame)
+    {
+        map<Server *, vector<int> > recipients;
+        map<struct mg_connection *, WebSocket *>::iterator it;
+
+        // Only the recipients are collected under the lock, the poll thread
+        // writes to them
+        mutex.lock();
+        for (it=websockets.begin(); it!=websockets.end(); it++) {
+            WebSocket *websocket = (*it).second;
+
+            if (websocket->_accept()) {
+                recipients[websocket->getServer()].push_back(websocket->getId());
+            }
+        }
         mutex.unlock();
+
+        map<Server *, vector<int> >::iterator rit;
+        for (rit=recipients.begin(); rit!=recipients.end(); rit++) {
+            (*rit).first->_webSocketSend((*rit).second, frame);
+        }
+
+        // The websockets owned are deleted by the poll thread, when their
+        // connection is closed
+        if (!responsible) {
+            clean();
+        }
     }
 
-    WebSocket *WebSockets::getWebSocket(int id)
+    void WebSockets::subscribe(WebSocket *websocket, const string &topic)
     {
-        if (websocketsById.find(id) != websocketsById.end()) {
-            return websocketsById[id];
+        int id = websocket->getId();
+
+        mutex.lock();
+        if (findWebSocket(id) == websocket) {
+            vector<string> &current = subscriptions[id];
+
+            if (find(current.begin(), current.end(), topic) == current.end()) {
+                map<string, WebSocketSubscribers *>::iterator it = topics.find(topic);
+                WebSocketSubscribers *subscribers;
+
+                if (it == topics.end()) {
+                    subscribers = new WebSocketSubscribers();
+                } else {
+                    subscribers = new WebSocketSubscribers(*(*it).second);
+                    (*it).second->release();
+                }
+
+                // The subscribers of a server are together
+                Server *server = websocket->getServer();
+                vector<WebSocketSubscribers::Group>::iterator git;
+                for (git=subscribers->groups.begin(); git!=subscribers->groups.end(); git++) {
+                    if ((*git).server == server) {
+                        break;
+                    }
+                }
+                if (git == subscribers->groups.end()) {
+                    WebSocketSubscribers::Group group;
+                    group.server = server;
+                    git = subscribers->groups.insert(git, group);
+                }
+                (*git).ids.push_back(id);
+
+                topics[topic] = subscribers;
+                current.push_back(topic);
+            }
         }
+        mutex.unlock();
+    }
 
-        return NULL;
+    void WebSockets::unsubscribe(WebSocket *websocket, const string &topic)
+    {
+        int id = websocket->getId();
+
+        mutex.lock();
+        map<int, vector<string> >::iterator it = subscriptions.find(id);
+
+        if (it != subscriptions.end()) {
+            vector<string>::iterator tit = find((*it).second.begin(), (*it).second.end(), topic);
+
+            if (tit != (*it).second.end()) {
+                (*it).second.erase(tit);
+                if ((*it).second.empty()) {
+                    subscriptions.erase(it);
+                }
+                removeSubscriber(id, topic);
+            }
+        }
+        mutex.unlock();
+    }
+
+    void WebSockets::removeSubscriber(int id, const string &topic)
+    {
+        map<string, WebSocketSubscribers *>::iterator it = topics.find(topic);
+
+        if (it == topics.end()) {
+            return;
+        }
+
+        // The publishers holding the previous subscribers go on with them
+        WebSocketSubscribers *subscribers = new WebSocketSubscribers(*(*it).second);
+        (*it).second->release();
+
+        vector<WebSocketSubscribers::Group>::iterator git;
+        for (git=subscribers->groups.begin(); git!=subscribers->groups.end(); git++) {
+            vector<int>::iterator iit = find((*git).ids.begin(), (*git).ids.end(), id);
+
+            if (iit != (*git).ids.end()) {
+                (*git).ids.erase(iit);
+                if ((*git).ids.empty()) {
+                    subscribers->groups.erase(git);
+                }
+                break;
+            }
+        }
+
+        if (subscribers->groups.empty()) {
+            subscribers->release();
+            topics.erase(it);
+        } else {
+            (*it).second = subscribers;
+        }
+    }
+
+    void WebSockets::publish(const string &topic, const string &data, int opcode)
+    {
+        publish(topic, mg_mk_str_n(data.data(), data.size()), opcode);
+    }
+
+    void WebSockets::publish(const string &topic, const struct mg_str &data, int opcode)
+    {
+        WebSocketFrame *frame = new WebSocketFrame(data.p, data.len, opcode);
+        publish(topic, frame);
+        frame->release();
+    }
+
+    void WebSockets::publish(const string &topic, WebSocketFrame *frame)
+    {
+        // Only taking a reference is done under the lock
+        mutex.lock();
+        map<string, WebSocketSubscribers *>::iterator it = topics.find(topic);
+        WebSocketSubscribers *subscribers = NULL;
+
+        if (it != topics.end()) {
+            subscribers = (*it).second;
+            subscribers->acquire();
+        }
+        mutex.unlock();
+
+        if (subscribers == NULL) {
+            return;
+        }
+
+        // The websockets closed meanwhile are skipped by the poll threads
+        vector<WebSocketSubscribers::Group>::iterator git;
+        for (git=subscribers->groups.begin(); git!=subscribers->groups.end(); git++) {
+            (*git).server->_webSocketSend((*git).ids, frame);
+        }
+        subscribers->release();
     }
 
-    void WebSockets::sendAll(string data)
+    WebSockets::QueueStats WebSockets::getQueueStats()
     {
-        vector<WebSocket *> toClean;
+        QueueStats stats = {0, 0, 0, 0, 0};
         map<struct mg_connection *, WebSocket *>::iterator it;
 
         mutex.lock();
         for (it=websockets.begin(); it!=websockets.end(); it++) {
             WebSocket *websocket = (*it).second;
+            size_t pendingBytes = websocket->getPendingBytes();
 
-            websocket->send(data);
+            stats.websockets++;
+            if (websocket->isSaturated()) {
+                stats.saturated++;
+            }
+            stats.pendingBytes += pendingBytes;
+            if (pendingBytes > stats.maxPendingBytes) {
+                stats.maxPendingBytes = pendingBytes;
+            }
+            stats.dropped += websocket->getDropped();
         }
         mutex.unlock();
 
-        clean();
+        return stats;
     }
 
     void WebSockets::remove(WebSocket *websocket, bool lock)
@@ -85,13 +366,32 @@ namespace Mongoose
         if (lock) {
             mutex.lock();
         }
-        if (websockets.find(connection) != websockets.end()) {
+        map<struct mg_connection *, WebSocket *>::iterator it = websockets.find(connection);
+
+        if (it != websockets.end() && (*it).second == websocket) {
             websocket->removeContainer(this);
-            websockets.erase(connection);
-            websocketsById.erase(websocket->getId());
+            websockets.erase(it);
+
+            if (responsible) {
+                slots[websocket->getId() & (slots.size() - 1)] = NULL;
+                used--;
+            } else {
+                websocketsById.erase(websocket->getId());
+            }
+
+            map<int, vector<string> >::iterator sit = subscriptions.find(websocket->getId());
+            if (sit != subscriptions.end()) {
+                vector<string>::iterator tit;
+                for (tit=(*sit).second.begin(); tit!=(*sit).second.end(); tit++) {
+                    removeSubscriber(websocket->getId(), *tit);
+                }
+                subscriptions.erase(sit);
+            }
 
             if (responsible) {
-                websocket->close();
+                // Its connection is gone or going, closing it would post a
+                // close for an id freed above
+                websocket->_markClosed();
                 websocket->notifyContainers();
                 delete websocket;
             }
@@ -103,11 +403,21 @@ namespace Mongoose
 
     WebSocket *WebSockets::getWebSocket(struct mg_connection *connection)
     {
-        if (websockets.find(connection) != websockets.end()) {
-            return websockets[connection];
+        // The server's container holds all the websockets of its connections
+        if (responsible) {
+            return (WebSocket *) connection->user_data;
         }
 
-        return NULL;
+        WebSocket *websocket = NULL;
+
+        mutex.lock();
+        map<struct mg_connection *, WebSocket *>::iterator it = websockets.find(connection);
+        if (it != websockets.end()) {
+            websocket = (*it).second;
+        }
+        mutex.unlock();
+
+        return websocket;
     }
 
     void WebSockets::clean()
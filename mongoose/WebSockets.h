@@ -2,6 +2,7 @@
 #define _MONGOOSE_WEBSOCKETS_H
 
 #include <map>
+#include <vector>
 #include <iostream>
 #include <mongoose.h>
 #include "WebSocket.h"
@@ -9,18 +10,72 @@
 
 using namespace std;
 
+/**
+ * Minimum number of slots of the table of the websockets by identifier
+ */
+#define WEBSOCKETS_MIN_SLOTS 16
+
 /**
  * WebSockets is an array that contains WebSocket connections, this
  * can be used for instance to broadcast informations to them.
  *
  * The function clean() allow to remove closed connections from the
  * array.
+ *
+ * The websockets can subscribe to topics. The subscribers of a topic are
+ * kept in an immutable, reference counted, snapshot: publishing only takes
+ * the lock to get a reference, and subscribing swaps in a changed copy.
  */
 namespace Mongoose
 {
+    /**
+     * The subscribers of a topic at some point, never modified once published
+     */
+    class WebSocketSubscribers
+    {
+        public:
+            /**
+             * The identifiers of the subscribers of a server, a message is
+             * handed to its poll thread for all of them at once
+             */
+            struct Group
+            {
+                Server *server;
+                vector<int> ids;
+            };
+
+            WebSocketSubscribers();
+            WebSocketSubscribers(const WebSocketSubscribers &other);
+
+            void acquire();
+            void release();
+
+            vector<Group> groups;
+
+        protected:
+            virtual ~WebSocketSubscribers();
+
+            AtomicCounter references;
+
+        private:
+            WebSocketSubscribers &operator=(const WebSocketSubscribers &);
+    };
+
     class WebSockets
     {
         public:
+            /**
+             * The state of the send queues of the websockets
+             */
+            struct QueueStats
+            {
+                size_t websockets;
+                size_t saturated;
+                size_t pendingBytes;
+                size_t maxPendingBytes;
+                long dropped;
+            };
+
             /**
              * Creates a websockets array, the responsible false specify whether the
              * container will be responsible for cleaning the websocket
@@ -37,12 +92,90 @@ namespace Mongoose
             void add(WebSocket *websocket);
 
             /**
-             * Send data to all sockets in this container
+             * Send data to all sockets in this container, this can be called
+             * from any thread
+             *
+             * The frame is encoded once and the connections queue a reference
+             * to it, the poll thread of their server writes it. The
+             * connections dropping the new messages are skipped while they
+             * are saturated
+             *
+             * @param string the data to send
+             * @param int the opcode
+             */
+            void sendAll(const string &data, int opcode = WEBSOCKET_OP_TEXT);
+
+            /**
+             * Sends binary data to all sockets in this container
+             *
+             * @param mg_str the data to send, copied once in the frame
+             * @param int the opcode
+             */
+            void sendAll(const struct mg_str &data, int opcode = WEBSOCKET_OP_BINARY);
+
+            /**
+             * Sends a frame already encoded to all sockets in this container
+             *
+             * @param WebSocketFrame* the frame, a reference is taken
+             */
+            void sendAll(WebSocketFrame *frame);
+
+            /**
+             * Subscribes a websocket of this container to a topic
+             *
+             * @param WebSocket* the websocket
+             * @param string the topic
+             */
+            void subscribe(WebSocket *websocket, const string &topic);
+
+            /**
+             * Unsubscribes a websocket from a topic
+             *
+             * @param WebSocket* the websocket
+             * @param string the topic
+             */
+            void unsubscribe(WebSocket *websocket, const string &topic);
+
+            /**
+             * Sends data to the subscribers of a topic, this can be called
+             * from any thread
+             *
+             * The frame is encoded once, like with sendAll()
+             *
+             * @param string the topic
+             * @param string the data to send
+             * @param int the opcode
+             */
+            void publish(const string &topic, const string &data, int opcode = WEBSOCKET_OP_TEXT);
+
+            /**
+             * Sends binary data to the subscribers of a topic
+             *
+             * @param string the topic
+             * @param mg_str the data to send, copied once in the frame
+             * @param int the opcode
              */
-            void sendAll(string data);
+            void publish(const string &topic, const struct mg_str &data, int opcode = WEBSOCKET_OP_BINARY);
 
             /**
-             * Gets the websocket corresponding to the given connection
+             * Sends a frame already encoded to the subscribers of a topic
+             *
+             * @param string the topic
+             * @param WebSocketFrame* the frame, a reference is taken
+             */
+            void publish(const string &topic, WebSocketFrame *frame);
+
+            /**
+             * Sums up the send queues of the websockets in this container
+             *
+             * @return QueueStats the totals, as of the last writes
+             */
+            QueueStats getQueueStats();
+
+            /**
+             * Gets the websocket corresponding to the given connection, the
+             * container responsible for the websockets reads it from the
+             * connection, on the poll thread
              *
              * @param strut mg_connection* the mongoose connection
              */
@@ -68,13 +201,56 @@ namespace Mongoose
              */
             WebSocket *getWebSocket(int id);
 
+            /**
+             * Internally used to get the websockets a message is sent to at
+             * once, the ones not found are skipped
+             *
+             * @param vector<int> the identifiers
+             * @param vector<WebSocket*> the websockets found
+             */
+            void _getWebSockets(const vector<int> &ids, vector<WebSocket *> &found);
+
         protected:
             Mutex mutex;
             map<struct mg_connection*, WebSocket*> websockets;
-            map<int, WebSocket*> websocketsById;
             bool responsible;
 
-            int id;
+            // The websockets by identifier. A responsible container gives
+            // increasing identifiers, like a counter, skipping the ones whose
+            // slot is taken, so that the slot of a websocket is its identifier
+            // modulo the size of the table; the identifiers given by another
+            // container are kept in a map
+            vector<WebSocket *> slots;
+            size_t used;
+            int nextId;
+            map<int, WebSocket*> websocketsById;
+
+            /**
+             * Doubles the size of the table, the websockets keep distinct
+             * slots as the mask only gets more bits. The lock must be held
+             */
+            void growSlots();
+
+            /**
+             * Gets a websocket by identifier, the lock must be held
+             *
+             * @param int the identifier
+             *
+             * @return WebSocket* the websocket, or NULL
+             */
+            WebSocket *findWebSocket(int id);
+
+            // The subscribers of each topic, and the topics of each websocket
+            map<string, WebSocketSubscribers *> topics;
+            map<int, vector<string> > subscriptions;
+
+            /**
+             * Removes a websocket from a topic, the lock must be held
+             *
+             * @param int the websocket identifier
+             * @param string the topic
+             */
+            void removeSubscriber(int id, const string &topic);
     };
 }
 
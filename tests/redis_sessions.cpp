@@ -0,0 +1,375 @@
+/**
+ * Drives the Redis sessions against a stub speaking the Redis protocol, run
+ * on its own mongoose manager and thread. The stub can hold the commands it
+ * gets, answer the reads with an error, or drop the connection.
+ *
+ * Usage: redis_sessions [http port, default 18190] [stub port, default 16390]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <mongoose/Server.h>
+#include <mongoose/WebController.h>
+#include <mongoose/RedisSessions.h>
+#include <mongoose/Utils.h>
+
+using namespace std;
+using namespace Mongoose;
+
+static int failures = 0;
+
+#define CHECK(condition, message) \
+    if (!(condition)) { \
+        printf("FAIL: %s\n", message); \
+        failures++; \
+    } else { \
+        printf("ok: %s\n", message); \
+    }
+
+/**
+ * The Redis stub, its state is shared with the test under the mutex
+ */
+static Mutex stubMutex;
+static map<string, map<string, string> > stubData;
+static bool stubHold = false;
+static bool stubError = false;
+static bool stubClose = false;
+static volatile bool stubRunning = true;
+
+/**
+ * Parses one command, an array of bulk strings
+ *
+ * @return int the size of the command, 0 if it is not complete
+ */
+static int parseCommand(const char *data, int size, vector<string> &arguments)
+{
+    const char *end = (const char *) memchr(data, '\n', size);
+
+    if (end == NULL || data[0] != '*') {
+        return 0;
+    }
+
+    int offset = end - data + 1;
+    int count = atoi(data + 1);
+
+    for (int i = 0; i < count; i++) {
+        end = (const char *) memchr(data + offset, '\n', size - offset);
+        if (end == NULL) {
+            return 0;
+        }
+        int length = atoi(data + offset + 1);
+        offset = end - data + 1;
+        if (size - offset < length + 2) {
+            return 0;
+        }
+        arguments.push_back(string(data + offset, length));
+        offset += length + 2;
+    }
+
+    return offset;
+}
+
+static void answer(struct mg_connection *connection, const vector<string> &arguments)
+{
+    string command = arguments[0];
+    string reply = ":1\r\n";
+
+    if (command == "HGETALL" && stubError) {
+        reply = "-LOADING Redis is loading the dataset in memory\r\n";
+    } else if (command == "HGETALL") {
+        map<string, string> &hash = stubData[arguments[1]];
+        char header[32];
+
+        snprintf(header, sizeof(header), "*%d\r\n", (int) hash.size() * 2);
+        reply = header;
+
+        map<string, string>::iterator it;
+        for (it=hash.begin(); it!=hash.end(); it++) {
+            RedisSessions::appendArgument(reply, (*it).first);
+            RedisSessions::appendArgument(reply, (*it).second);
+        }
+    } else if (command == "HSET") {
+        stubData[arguments[1]][arguments[2]] = arguments[3];
+    } else if (command == "HDEL") {
+        stubData[arguments[1]].erase(arguments[2]);
+    }
+
+    mg_send(connection, reply.data(), reply.size());
+}
+
+static void stub_handler(struct mg_connection *connection, int ev, void *)
+{
+    if (ev != MG_EV_RECV && ev != MG_EV_POLL) {
+        return;
+    }
+
+    struct mbuf *buffer = &connection->recv_mbuf;
+
+    stubMutex.lock();
+    while (!stubHold && buffer->len > 0) {
+        vector<string> arguments;
+        int size = parseCommand(buffer->buf, buffer->len, arguments);
+
+        if (size == 0) {
+            break;
+        }
+        mbuf_remove(buffer, size);
+
+        if (stubClose) {
+            stubClose = false;
+            connection->flags |= MG_F_CLOSE_IMMEDIATELY;
+            break;
+        }
+        answer(connection, arguments);
+    }
+    stubMutex.unlock();
+}
+
+static void *stub_thread(void *param)
+{
+    struct mg_mgr *mgr = (struct mg_mgr *) param;
+
+    while (stubRunning) {
+        mg_mgr_poll(mgr, 10);
+    }
+    mg_mgr_free(mgr);
+
+    return NULL;
+}
+
+static void setStub(bool &flag, bool value)
+{
+    stubMutex.lock();
+    flag = value;
+    stubMutex.unlock();
+}
+
+/**
+ * The controller of the test, the session is kept to be written from the
+ * test thread
+ */
+static Session *captured = NULL;
+
+class SessionController : public WebController
+{
+    public:
+        void set(Request &request, StreamResponse &response)
+        {
+            Session &session = getSession(request, response);
+            session.setValue(request.get("k"), request.get("v"));
+            captured = &session;
+            response << "ok";
+        }
+
+        void get(Request &request, StreamResponse &response)
+        {
+            response << getSession(request, response).get(request.get("k"), "(none)");
+        }
+
+        void setup()
+        {
+            addRoute("GET", "/set", SessionController, set);
+            addRoute("GET", "/get", SessionController, get);
+        }
+};
+
+/**
+ * Sends a request on a new connection
+ *
+ * @return string the response, empty on error
+ */
+static string query(int port, const string &path, const string &cookie)
+{
+    struct sockaddr_in address;
+    string response;
+    char buffer[4096];
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *) &address, sizeof(address)) != 0) {
+        if (sock >= 0) {
+            close(sock);
+        }
+        return response;
+    }
+
+    struct timeval timeout;
+    timeout.tv_sec = 5;
+    timeout.tv_usec = 0;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char *) &timeout, sizeof(timeout));
+
+    string request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n" + cookie + "\r\n";
+    send(sock, request.data(), request.size(), 0);
+
+    while (true) {
+        int received = recv(sock, buffer, sizeof(buffer), 0);
+        if (received <= 0) {
+            break;
+        }
+        response.append(buffer, received);
+
+        size_t body = response.find("\r\n\r\n");
+        size_t length = response.find("Content-Length: ");
+        if (body != string::npos && length != string::npos &&
+                response.size() - body - 4 >= (size_t) atoi(response.c_str() + length + 16)) {
+            break;
+        }
+    }
+    close(sock);
+
+    return response;
+}
+
+static string body(const string &response)
+{
+    size_t position = response.find("\r\n\r\n");
+
+    return position == string::npos ? "" : response.substr(position + 4);
+}
+
+static bool isError(const string &response)
+{
+    return response.compare(0, 12, "HTTP/1.0 500") == 0 || response.compare(0, 12, "HTTP/1.1 500") == 0;
+}
+
+/**
+ * Queries from another thread, so that the test goes on while the session
+ * is loaded
+ */
+struct Client
+{
+    int port;
+    string path;
+    string cookie;
+    string response;
+    volatile bool done;
+};
+
+static void *client_thread(void *param)
+{
+    Client *client = (Client *) param;
+
+    client->response = query(client->port, client->path, client->cookie);
+    client->done = true;
+
+    return NULL;
+}
+
+static void startClient(Client &client, int port, const string &path, const string &cookie)
+{
+    client.port = port;
+    client.path = path;
+    client.cookie = cookie;
+    client.done = false;
+    mg_start_thread(client_thread, &client);
+}
+
+static void waitClient(Client &client)
+{
+    while (!client.done) {
+        Utils::xsleep(10);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int port = argc > 1 ? atoi(argv[1]) : 18190;
+    int stubPort = argc > 2 ? atoi(argv[2]) : 16390;
+    char portName[16], stubAddress[32];
+
+    snprintf(portName, sizeof(portName), "%d", port);
+    snprintf(stubAddress, sizeof(stubAddress), "127.0.0.1:%d", stubPort);
+
+    struct mg_mgr stubManager;
+    mg_mgr_init(&stubManager, NULL);
+    if (mg_bind(&stubManager, stubAddress, stub_handler) == NULL) {
+        printf("Can't bind the stub on %s\n", stubAddress);
+        return 1;
+    }
+    mg_start_thread(stub_thread, &stubManager);
+
+    Server server(portName);
+    RedisSessions sessions(&server, stubAddress);
+    // Every request with a session reads it again
+    sessions.setCacheTtl(0);
+    server.setSessions(&sessions);
+    server.registerController(new SessionController);
+    server.start();
+
+    // A new session is written without being read
+    string response = query(port, "/set?k=user&v=alice", "");
+    size_t position = response.find("sessid=");
+    CHECK(body(response) == "ok" && position != string::npos, "new session written");
+    if (position == string::npos) {
+        server.stop();
+        return 1;
+    }
+    string cookie = "Cookie: " + response.substr(position, response.find_first_of(";\r", position) - position) + "\r\n";
+    Utils::xsleep(100);
+
+    // The reads held by the stub are pipelined on the connection, and are
+    // answered in order when it lets them go
+    setStub(stubHold, true);
+    Client clients[8];
+    for (int i = 0; i < 8; i++) {
+        startClient(clients[i], port, "/get?k=user", cookie);
+    }
+    Utils::xsleep(300);
+    setStub(stubHold, false);
+
+    int read = 0;
+    for (int i = 0; i < 8; i++) {
+        waitClient(clients[i]);
+        if (body(clients[i].response) == "alice") {
+            read++;
+        }
+    }
+    CHECK(read == 8, "pipelined reads answered in order");
+
+    // A read in flight when the session is written locally predates the
+    // write, it does not replace the values
+    setStub(stubHold, true);
+    Client client;
+    startClient(client, port, "/get?k=user", cookie);
+    Utils::xsleep(300);
+    captured->setValue("user", "bob");
+    Utils::xsleep(300);
+    setStub(stubHold, false);
+    waitClient(client);
+    CHECK(body(client.response) == "bob", "read from before a local write ignored");
+    CHECK(body(query(port, "/get?k=user", cookie)) == "bob", "next read has the write");
+
+    // An error reply fails the load and keeps the values
+    setStub(stubError, true);
+    response = query(port, "/get?k=user", cookie);
+    setStub(stubError, false);
+    CHECK(isError(response), "error reply fails the load");
+    CHECK(captured->get("user") == "bob", "error reply keeps the values");
+
+    // The loads pending when the connection is lost fail, and the next one
+    // connects again
+    setStub(stubClose, true);
+    response = query(port, "/get?k=user", cookie);
+    CHECK(isError(response), "lost connection fails the load");
+    CHECK(body(query(port, "/get?k=user", cookie)) == "bob", "connection made again");
+
+    server.stop();
+    stubRunning = false;
+    Utils::xsleep(100);
+
+    printf("%d failure(s)\n", failures);
+
+    return failures == 0 ? 0 : 1;
+}